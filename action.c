@@ -20,25 +20,30 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "action.h"
 #include "buffer.h"
 #include "command.h"
+#include "compress.h"
 #include "db.h"
 #include "err.h"
+#include "export.h"
 #include "output.h"
+#include "pager.h"
 #include "parser.h"
 #include "results.h"
 #include "stream.h"
 
 
-static void go(buffer *sqlbuf, char action, parsed_line *params, stream *stream)
+static results *run(buffer *sqlbuf, parsed_line *params)
 {
 	results *res = NULL;
 
@@ -54,7 +59,14 @@ static void go(buffer *sqlbuf, char action, parsed_line *params, stream *stream)
 		break;
 	}
 
-	if(res) {
+	return res;
+}
+
+static void go(buffer *sqlbuf, char action, parsed_line *params, stream *stream)
+{
+	results *res;
+
+	if((res = run(sqlbuf, params))) {
 		output_results(res, action, stream);
 		res_free(res);
 	}
@@ -102,6 +114,111 @@ static void edit(buffer *sqlbuf)
 	unlink(path);
 }
 
+/*
+  Open the target of a `>' or `>>' redirection ourselves rather than
+  through the shell, so the output doesn't have to go through cat.
+  Names that need the shell's quoting or expansions are left to it:
+  returns 0 with *shell set in that case.
+*/
+static FILE *open_redirect(const char *target, char **name, int *shell)
+{
+	int append, fd;
+	size_t l;
+	FILE *f;
+
+	*shell = 0;
+
+	append = target[1] == '>';
+	for(target += append + 1; *target == ' ' || *target == '\t'; target++);
+
+	l = strlen(target);
+	while(l && (target[l - 1] == ' ' || target[l - 1] == '\t' || target[l - 1] == '\n')) l--;
+
+	if(!l || strcspn(target, " \t\n'\"\\$`~*?[{&;|<>()") < l) {
+		*shell = 1;
+		return 0;
+	}
+
+	if(!(*name = malloc(l + 1))) err_system();
+	memcpy(*name, target, l);
+	(*name)[l] = 0;
+
+	fd = open(*name, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+	if(fd == -1) {
+		perror(_("Failed to open file"));
+		free(*name);
+		return 0;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	if(!(f = fdopen(fd, append ? "a" : "w"))) err_system();
+	return f;
+}
+
+static char *copy(const char *s, size_t n)
+{
+	char *c;
+
+	if(!(c = malloc(n + 1))) err_system();
+	memcpy(c, s, n);
+	c[n] = 0;
+
+	return c;
+}
+
+/*
+  Whether target is a `>' or `>>' redirection to a SQLite database,
+  optionally followed by the table to write to, as in
+  "> snapshot.sqlite orders".  If so, sets *file and *table.
+*/
+static int sqlite_redirect(const char *target, char **file, char **table)
+{
+	const char *p, *q;
+
+	for(p = target + (target[1] == '>') + 1; isspace((unsigned char) *p); p++);
+	for(q = p; *q && !isspace((unsigned char) *q); q++);
+
+	*file = copy(p, q - p);
+	if(!export_sqlite_target(*file)) {
+		free(*file);
+		return 0;
+	}
+
+	for(p = q; isspace((unsigned char) *p); p++);
+	for(q = p; *q && !isspace((unsigned char) *q); q++);
+	*table = q > p ? copy(p, q - p) : copy("results", 7);
+
+	for(; isspace((unsigned char) *q); q++);
+	if(*q) {
+		free(*file);
+		free(*table);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void report_redirect(const char *name, size_t bytes, size_t compressed,
+			    const struct timespec *start)
+{
+	struct timespec end;
+	double t;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &end)) err_system();
+	t = end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+
+	if(compressed)
+		printf(_("%lu bytes (%lu compressed) written to %s in %.3fs (%.1fMB/s)\n"),
+		       (unsigned long) bytes, (unsigned long) compressed, name, t,
+		       t > 0 ? bytes / t / 1e6 : 0.0);
+	else
+		printf(_("%lu bytes written to %s in %.3fs (%.1fMB/s)\n"),
+		       (unsigned long) bytes, name, t, t > 0 ? bytes / t / 1e6 : 0.0);
+}
+
 static void print(buffer *sqlbuf, stream *stream)
 {
 	stream_write(stream, sqlbuf->buf, sqlbuf->next);
@@ -111,17 +228,47 @@ static void print(buffer *sqlbuf, stream *stream)
 void run_action(buffer *sqlbuf, char action, char *paramstring)
 {
 	parsed_line *l;
-	char *pipeline;
-	FILE *f;
+	results *res;
+	char *pipeline, *file, *table;
+	FILE *f = 0;
 	stream *stream;
-	int m;
+	compressor *compressor;
+	struct timespec start;
+	size_t bytes;
+	int m, shell;
 
 	pipeline = 0;
+	file = 0;
+	compressor = 0;
 	m = 0;
+	shell = 1;
 
 	l = parse_string(paramstring);
 
-	if(l->pipeline) {
+	// query results into a table rather than as text
+	if(l->pipeline && *l->pipeline == '>' && !strchr("elprs", action) &&
+	   sqlite_redirect(l->pipeline, &file, &table)) {
+		if((res = run(sqlbuf, l))) {
+			export_sqlite(res, file, table, l->pipeline[1] == '>');
+			res_free(res);
+		}
+
+		free(file);
+		free(table);
+		free_parsed_line(l);
+		return;
+	}
+
+	if(l->pipeline && *l->pipeline == '>') {
+		if(clock_gettime(CLOCK_MONOTONIC, &start)) err_system();
+		f = open_redirect(l->pipeline, &file, &shell);
+		if(!f && !shell) {
+			free_parsed_line(l);
+			return;
+		}
+	}
+
+	if(l->pipeline && shell) {
 		if(*l->pipeline == '>') {
 			if(!(pipeline = malloc(strlen(l->pipeline) + 5))) err_system();
 			m = 1;
@@ -131,9 +278,16 @@ void run_action(buffer *sqlbuf, char action, char *paramstring)
 		}
 	}
 
-	if(!pipeline) pipeline = getenv("DBSH_DEFAULT_PAGER");
+	if(!pipeline && !file) {
+		pipeline = getenv("DBSH_DEFAULT_PAGER");
 
-	if(pipeline) {
+		// output_results() does the paging itself
+		if(pipeline && !strcmp(pipeline, PAGER_INTERNAL)) pipeline = 0;
+	}
+
+	if(file) {
+		// already open
+	} else if(pipeline) {
 		f = popen(pipeline, "w");
 		if(m) free(pipeline);
 		if(!f) {
@@ -144,6 +298,11 @@ void run_action(buffer *sqlbuf, char action, char *paramstring)
 
 	stream = stream_create(f);
 
+	if(file && compress_type_for(file) != COMPRESS_NONE) {
+		compressor = compress_create(fileno(f), compress_type_for(file));
+		stream_set_compressor(stream, compressor);
+	}
+
 
 	switch(action) {
 	case 'e':  // edit
@@ -169,8 +328,14 @@ void run_action(buffer *sqlbuf, char action, char *paramstring)
 
 
 	stream_reset(stream);
-	if(pipeline) pclose(f);
-	free(stream);
+	bytes = stream_bytes(stream);
+	stream_free(stream);
+
+	if(file) {
+		report_redirect(file, bytes, compressor ? compress_finish(compressor) : 0, &start);
+		fclose(f);
+		free(file);
+	} else if(pipeline) pclose(f);
 
 	free_parsed_line(l);
 }
@@ -0,0 +1,179 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Bump allocator for result storage.  Everything allocated from an
+  arena is released at once by arena_free(), which hands the chunks
+  back to a small pool so the next query can reuse them without going
+  back to malloc.  Pooled chunks are counted as caches by /mem.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "arena.h"
+#include "err.h"
+#include "mem.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_POOL_MAX 256
+#define ARENA_ALIGN sizeof(void *)
+
+typedef struct chunk chunk;
+
+struct chunk {
+	chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct arena {
+	chunk *head;
+	chunk *tail;
+	int nchunks;
+};
+
+
+static chunk *pool;
+static int pool_len;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static chunk *chunk_alloc(size_t size)
+{
+	chunk *c = 0;
+
+	if(size == ARENA_CHUNK_SIZE) {
+		pthread_mutex_lock(&pool_lock);
+		if(pool) {
+			c = pool;
+			pool = c->next;
+			pool_len--;
+			mem_sub(MEM_CACHES, sizeof(chunk) + size);
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	if(!c) {
+		if(!(c = malloc(sizeof(chunk) + size))) err_system();
+		c->size = size;
+	}
+
+	c->next = 0;
+	c->used = 0;
+
+	return c;
+}
+
+static void chunk_free(chunk *c)
+{
+	if(c->size == ARENA_CHUNK_SIZE) {
+		pthread_mutex_lock(&pool_lock);
+		if(pool_len < ARENA_POOL_MAX) {
+			c->next = pool;
+			pool = c;
+			pool_len++;
+			c = 0;
+			mem_add(MEM_CACHES, sizeof(chunk) + ARENA_CHUNK_SIZE);
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	if(c) free(c);
+}
+
+arena *arena_create()
+{
+	arena *a;
+
+	if(!(a = calloc(1, sizeof(arena)))) err_system();
+	return a;
+}
+
+void *arena_alloc(arena *a, size_t len)
+{
+	chunk *c;
+	void *p;
+
+	len = (len + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	c = a->tail;
+
+	if(!c || c->used + len > c->size) {
+		if(len > ARENA_CHUNK_SIZE / 4) {
+			// big allocations get a chunk to themselves, kept at
+			// the front so the current tail stays in use
+			c = chunk_alloc(len);
+			c->next = a->head;
+			a->head = c;
+			if(!a->tail) a->tail = c;
+			a->nchunks++;
+			c->used = len;
+			return c->data;
+		}
+
+		c = chunk_alloc(ARENA_CHUNK_SIZE);
+		if(a->tail) a->tail->next = c;
+		else a->head = c;
+		a->tail = c;
+		a->nchunks++;
+	}
+
+	p = c->data + c->used;
+	c->used += len;
+
+	return p;
+}
+
+/*
+  Forget everything allocated so far, keeping one chunk for reuse.
+*/
+void arena_reset(arena *a)
+{
+	chunk *c, *next;
+
+	for(c = a->head; c; c = next) {
+		next = c->next;
+		if(c->size == ARENA_CHUNK_SIZE && c == a->tail) continue;
+		chunk_free(c);
+	}
+
+	if(a->tail && a->tail->size == ARENA_CHUNK_SIZE) {
+		a->head = a->tail;
+		a->head->next = 0;
+		a->head->used = 0;
+		a->nchunks = 1;
+	} else {
+		a->head = a->tail = 0;
+		a->nchunks = 0;
+	}
+}
+
+void arena_free(arena *a)
+{
+	chunk *c, *next;
+
+	for(c = a->head; c; c = next) {
+		next = c->next;
+		chunk_free(c);
+	}
+
+	free(a);
+}
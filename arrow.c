@@ -0,0 +1,1138 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Output in, and loading from, the Apache Arrow IPC streaming format,
+  without the Arrow libraries.
+
+  A stream is a schema message, a record batch message for every
+  DBSH_ARROW_BATCH_ROWS rows and an end-of-stream marker.  Each message
+  is a continuation marker, the length of its metadata, the metadata (a
+  FlatBuffer) and, for a record batch, the body: each column's buffers,
+  padded to 8 bytes.
+
+  The FlatBuffers are built front to back: a table is written before
+  the strings, vectors and tables it refers to, and their offsets are
+  patched in once they've been written, so that every offset points
+  forward as the format requires.  All numbers, in the metadata and in
+  the body, are written little-endian whatever the host.
+
+  Columns are typed from what the driver reported: integers as Int64,
+  floating point as Float64, timestamps as Timestamp (microseconds, no
+  time zone) and everything else, decimals included, as Utf8.  A value
+  that won't convert to its column's type is written as null, with a
+  warning.
+
+  Streams are read a message at a time, checking every offset in the
+  metadata and every buffer in the body against what was actually
+  read.  The values are left where they are in the body, so that the
+  loader (see db_load_arrow()) can bind most columns as they are.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "arrow.h"
+#include "err.h"
+#include "mem.h"
+#include "results.h"
+#include "stream.h"
+
+#define ARROW_BATCH_ROWS 65536
+#define ARROW_MAX_FIELDS 6
+#define ARROW_MAX_STRINGS (1 << 30)  // keeps well inside 32-bit offsets
+#define ARROW_READ_CHUNK (1024 * 1024)
+
+#define PAD8(n) (((n) + 7) & ~(size_t) 7)
+
+// from Schema.fbs and Message.fbs
+#define METADATA_V5 4
+#define HEADER_SCHEMA 1
+#define HEADER_RECORD_BATCH 3
+#define TYPE_INT 2
+#define TYPE_FLOATING_POINT 3
+#define TYPE_BINARY 4
+#define TYPE_UTF8 5
+#define TYPE_BOOL 6
+#define TYPE_DATE 8
+#define TYPE_TIMESTAMP 10
+#define TYPE_LARGE_BINARY 19
+#define TYPE_LARGE_UTF8 20
+#define PRECISION_SINGLE 1
+#define PRECISION_DOUBLE 2
+#define UNIT_MICROSECOND 2
+#define UNIT_NANOSECOND 3
+
+
+typedef struct {
+	unsigned char *buf;
+	size_t len;
+	size_t cap;
+} bytes;
+
+typedef struct {
+	int nfields;
+	int size[ARROW_MAX_FIELDS];  // 0 if absent
+	uint64_t value[ARROW_MAX_FIELDS];
+	size_t pos[ARROW_MAX_FIELDS];
+} fb_table;
+
+typedef struct {
+	res_type type;
+	char *name;
+	bytes validity;
+	bytes offsets;
+	bytes values;
+	long nulls;
+	long bad;
+} column;
+
+struct arrow_writer {
+	stream *s;
+	results *res;
+	int ncols;
+	column *cols;
+	long nrows;
+	long batch_rows;
+	bytes fb;
+};
+
+typedef struct {
+	const unsigned char *buf;
+	size_t len;
+	int bad;
+} fb_reader;
+
+struct arrow_reader {
+	FILE *f;
+	int ncols;
+	arrow_column *cols;
+	bytes metadata;
+	bytes body;
+};
+
+
+static unsigned char *bytes_add(bytes *, size_t);
+static void bytes_free(bytes *);
+static void put_le(unsigned char *, uint64_t, int);
+static size_t fb_grow(bytes *, size_t);
+static void fb_align(bytes *, size_t);
+static void fb_put(bytes *, size_t, uint64_t, int);
+static void fb_patch(bytes *, size_t, size_t);
+static void fb_field(fb_table *, int, int, uint64_t);
+static size_t fb_end_table(bytes *, fb_table *);
+static size_t fb_string(bytes *, const char *);
+static size_t fb_vector(bytes *, int, int, int);
+static size_t message_start(bytes *, int, fb_table *);
+static void write_message(arrow_writer *, fb_table *, size_t);
+static void write_schema(arrow_writer *);
+static void write_batch(arrow_writer *);
+static int column_buffers(column *, long, const unsigned char **, size_t *);
+static void append(column *, long, const char *);
+static int parse_int(const char *, int64_t *);
+static int parse_float(const char *, double *);
+static int parse_timestamp(const char *, int64_t *);
+static uint64_t get_le(const unsigned char *, int);
+static int fbr_has(fb_reader *, size_t, size_t);
+static uint64_t fbr_get(fb_reader *, size_t, int);
+static size_t fbr_deref(fb_reader *, size_t);
+static size_t fbr_field(fb_reader *, size_t, int);
+static uint64_t fbr_scalar(fb_reader *, size_t, int, int, uint64_t);
+static size_t fbr_ref(fb_reader *, size_t, int);
+static size_t fbr_vector(fb_reader *, size_t, size_t);
+static int read_bytes(arrow_reader *, bytes *, size_t);
+static int read_message(arrow_reader *, fb_reader *, size_t *);
+static int read_schema(arrow_reader *);
+static int read_field(fb_reader *, size_t, arrow_column *);
+static int read_column(arrow_reader *, fb_reader *, arrow_column *, long,
+		       size_t, size_t, size_t, size_t *);
+static void read_failed(arrow_reader *);
+static int host_little_endian();
+
+
+arrow_writer *arrow_writer_create(results *res, stream *s)
+{
+	arrow_writer *w;
+	const char *batch;
+	size_t l;
+	int i;
+
+	if(!(w = calloc(1, sizeof(arrow_writer)))) err_system();
+
+	w->s = s;
+	w->res = res;
+	w->ncols = res_get_ncols(res);
+	if(!(w->cols = calloc(w->ncols, sizeof(column)))) err_system();
+
+	batch = getenv("DBSH_ARROW_BATCH_ROWS");
+	w->batch_rows = batch ? atol(batch) : 0;
+	if(w->batch_rows < 1) w->batch_rows = ARROW_BATCH_ROWS;
+
+	for(i = 0; i < w->ncols; i++) {
+		w->cols[i].type = res_get_col_type(res, i);
+		if(w->cols[i].type == RES_TYPE_DECIMAL) w->cols[i].type = RES_TYPE_TEXT;
+
+		if((l = wcstombs(0, res_get_col(res, i), 0)) == (size_t) -1) err_system();
+		if(!(w->cols[i].name = malloc(l + 1))) err_system();
+		wcstombs(w->cols[i].name, res_get_col(res, i), l + 1);
+	}
+
+	write_schema(w);
+
+	return w;
+}
+
+/*
+  Add a row (as from res_get_mb_row()), writing out a batch when there
+  are enough.
+*/
+void arrow_writer_row(arrow_writer *w, char **data)
+{
+	int i, full;
+
+	full = 0;
+	for(i = 0; i < w->ncols; i++) {
+		append(&w->cols[i], w->nrows, data[i]);
+		if(w->cols[i].values.len > ARROW_MAX_STRINGS) full = 1;
+	}
+
+	if(++w->nrows == w->batch_rows || full) write_batch(w);
+}
+
+/*
+  Write the last batch and the end of the stream, add a warning to the
+  results for each column that had values nulled, and free w.
+*/
+void arrow_writer_finish(arrow_writer *w)
+{
+	static const char eos[8] = "\xff\xff\xff\xff\0\0\0";
+	char warning[256];
+	column *c;
+	int i;
+
+	if(w->nrows) write_batch(w);
+	stream_write(w->s, eos, sizeof(eos));
+
+	for(i = 0; i < w->ncols; i++) {
+		c = &w->cols[i];
+
+		if(c->bad) {
+			snprintf(warning, sizeof(warning),
+				 ngettext("%ld value in column %s couldn't be converted and was written as null",
+					  "%ld values in column %s couldn't be converted and were written as null",
+					  c->bad),
+				 c->bad, c->name);
+			res_add_warning(w->res, warning);
+		}
+
+		free(c->name);
+		bytes_free(&c->validity);
+		bytes_free(&c->offsets);
+		bytes_free(&c->values);
+	}
+
+	free(w->cols);
+	bytes_free(&w->fb);
+	free(w);
+}
+
+/*
+  Start reading a stream from f, up to the end of its schema.  Returns
+  0 (having said why) if it isn't one that can be loaded.
+*/
+arrow_reader *arrow_reader_open(FILE *f)
+{
+	arrow_reader *r;
+
+	if(!(r = calloc(1, sizeof(arrow_reader)))) err_system();
+	r->f = f;
+
+	if(!read_schema(r)) {
+		arrow_reader_free(r);
+		return 0;
+	}
+
+	return r;
+}
+
+int arrow_reader_ncols(arrow_reader *r)
+{
+	return r->ncols;
+}
+
+const arrow_column *arrow_reader_column(arrow_reader *r, int i)
+{
+	return &r->cols[i];
+}
+
+/*
+  Read the next record batch, pointing the columns at its values.
+  Returns its number of rows: 0 at the end of the stream, and -1 (having
+  said why) if it can't be read.  The previous batch's values are gone
+  once this is called.
+*/
+long arrow_reader_next(arrow_reader *r)
+{
+	fb_reader fb;
+	size_t batch, nodes, buffers, nbuffers, k;
+	int64_t length;
+	int i, type;
+
+	if((type = read_message(r, &fb, &batch)) <= 0) return type;
+
+	if(type != HEADER_RECORD_BATCH) {
+		puts(_("Unexpected message in Arrow stream"));
+		return -1;
+	}
+
+	if(fbr_field(&fb, batch, 3)) {
+		puts(_("Compressed Arrow record batches can't be loaded"));
+		return -1;
+	}
+
+	length = fbr_scalar(&fb, batch, 0, 8, 0);
+	nodes = fbr_ref(&fb, batch, 1);
+	buffers = fbr_ref(&fb, batch, 2);
+	nbuffers = fbr_vector(&fb, buffers, 16);
+
+	// every column needs at least a bit per row
+	if(fb.bad || length < 0 || length > LONG_MAX || length / 8 > r->body.len ||
+	   fbr_vector(&fb, nodes, 16) != r->ncols) {
+		puts(_("Malformed Arrow stream"));
+		return -1;
+	}
+
+	for(i = k = 0; i < r->ncols; i++)
+		if(!read_column(r, &fb, &r->cols[i], length, nodes + 4 + 16 * i,
+				buffers + 4, nbuffers, &k)) {
+			puts(_("Malformed Arrow stream"));
+			return -1;
+		}
+
+	return length;
+}
+
+/*
+  Value j of a UTF8 or BINARY column, and its length.
+*/
+const unsigned char *arrow_value(const arrow_column *c, long j, size_t *len)
+{
+	uint64_t start;
+
+	start = get_le(c->offsets + j * c->width, c->width);
+	*len = get_le(c->offsets + (j + 1) * c->width, c->width) - start;
+
+	return c->values + start;
+}
+
+void arrow_reader_free(arrow_reader *r)
+{
+	int i;
+
+	for(i = 0; i < r->ncols; i++) free(r->cols[i].name);
+	free(r->cols);
+	bytes_free(&r->metadata);
+	bytes_free(&r->body);
+	free(r);
+}
+
+
+static unsigned char *bytes_add(bytes *b, size_t n)
+{
+	size_t cap;
+
+	if(b->len + n > b->cap) {
+		for(cap = b->cap ? b->cap : 1024; cap < b->len + n; cap *= 2);
+		if(!(b->buf = realloc(b->buf, cap))) err_system();
+		mem_add(MEM_BUFFERS, cap - b->cap);
+		b->cap = cap;
+	}
+
+	b->len += n;
+	return b->buf + b->len - n;
+}
+
+static void bytes_free(bytes *b)
+{
+	mem_sub(MEM_BUFFERS, b->cap);
+	free(b->buf);
+}
+
+static void put_le(unsigned char *p, uint64_t v, int size)
+{
+	int i;
+
+	for(i = 0; i < size; i++, v >>= 8) p[i] = v & 0xff;
+}
+
+/*
+  Add n zeroed bytes to a FlatBuffer, returning where they start.
+  Positions rather than pointers, since the buffer moves as it grows.
+*/
+static size_t fb_grow(bytes *b, size_t n)
+{
+	memset(bytes_add(b, n), 0, n);
+	return b->len - n;
+}
+
+static void fb_align(bytes *b, size_t a)
+{
+	if(b->len % a) fb_grow(b, a - b->len % a);
+}
+
+static void fb_put(bytes *b, size_t pos, uint64_t v, int size)
+{
+	put_le(b->buf + pos, v, size);
+}
+
+// point the offset at pos to target
+static void fb_patch(bytes *b, size_t pos, size_t target)
+{
+	fb_put(b, pos, target - pos, 4);
+}
+
+/*
+  Give a table field, by its index in the schema.  Offsets (size 4,
+  value 0) are patched once what they refer to has been written.
+*/
+static void fb_field(fb_table *t, int id, int size, uint64_t value)
+{
+	t->size[id] = size;
+	t->value[id] = value;
+	if(id >= t->nfields) t->nfields = id + 1;
+}
+
+/*
+  Write a table's vtable, then the table itself with its fields largest
+  first so that they pack.  Returns where the table starts; t->pos says
+  where each field went.
+*/
+static size_t fb_end_table(bytes *b, fb_table *t)
+{
+	size_t vtable, table;
+	int i, size;
+
+	fb_align(b, 2);
+	vtable = fb_grow(b, 4 + 2 * t->nfields);
+	fb_align(b, 4);
+	table = fb_grow(b, 4);
+	fb_put(b, table, table - vtable, 4);
+
+	for(size = 8; size; size /= 2)
+		for(i = 0; i < t->nfields; i++) {
+			if(t->size[i] != size) continue;
+			fb_align(b, size);
+			t->pos[i] = fb_grow(b, size);
+			fb_put(b, t->pos[i], t->value[i], size);
+			fb_put(b, vtable + 4 + 2 * i, t->pos[i] - table, 2);
+		}
+
+	fb_put(b, vtable, 4 + 2 * t->nfields, 2);
+	fb_put(b, vtable + 2, b->len - table, 2);
+
+	return table;
+}
+
+static size_t fb_string(bytes *b, const char *s)
+{
+	size_t pos, l;
+
+	l = strlen(s);
+	fb_align(b, 4);
+	pos = fb_grow(b, 4 + l + 1);
+	fb_put(b, pos, l, 4);
+	memcpy(b->buf + pos + 4, s, l);
+
+	return pos;
+}
+
+/*
+  Add a vector of n elements of the given size, aligned so that the
+  elements (which start 4 bytes in, after the length) are aligned to
+  align.
+*/
+static size_t fb_vector(bytes *b, int n, int size, int align)
+{
+	size_t pos;
+
+	fb_align(b, 4);
+	while((b->len + 4) % align) fb_grow(b, 4);
+
+	pos = fb_grow(b, 4 + (size_t) n * size);
+	fb_put(b, pos, n, 4);
+
+	return pos;
+}
+
+/*
+  Start a message's metadata with the root Message table, which the
+  header (returned in m) has to be patched into.
+*/
+static size_t message_start(bytes *b, int header_type, fb_table *m)
+{
+	size_t root;
+
+	b->len = 0;
+	root = fb_grow(b, 4);
+
+	memset(m, 0, sizeof(fb_table));
+	fb_field(m, 0, 2, METADATA_V5);
+	fb_field(m, 1, 1, header_type);
+	fb_field(m, 2, 4, 0);
+	fb_field(m, 3, 8, 0);  // bodyLength
+	fb_patch(b, root, fb_end_table(b, m));
+
+	return m->pos[2];
+}
+
+/*
+  Write the continuation marker, the metadata length and the metadata,
+  padded so that the body that follows starts 8-aligned.
+*/
+static void write_message(arrow_writer *w, fb_table *m, size_t body)
+{
+	unsigned char prefix[8];
+	bytes *b;
+
+	b = &w->fb;
+	fb_put(b, m->pos[3], body, 8);
+	fb_align(b, 8);
+
+	put_le(prefix, 0xffffffff, 4);
+	put_le(prefix + 4, b->len, 4);
+	stream_write(w->s, (const char *) prefix, sizeof(prefix));
+	stream_write(w->s, (const char *) b->buf, b->len);
+}
+
+static void write_schema(arrow_writer *w)
+{
+	bytes *b;
+	fb_table m, schema, field, type;
+	size_t fields, pos;
+	column *c;
+	int i;
+
+	b = &w->fb;
+	pos = message_start(b, HEADER_SCHEMA, &m);
+
+	memset(&schema, 0, sizeof(schema));
+	fb_field(&schema, 0, 2, 0);  // little-endian
+	fb_field(&schema, 1, 4, 0);
+	fb_patch(b, pos, fb_end_table(b, &schema));
+
+	fields = fb_vector(b, w->ncols, 4, 4);
+	fb_patch(b, schema.pos[1], fields);
+
+	for(i = 0; i < w->ncols; i++) {
+		c = &w->cols[i];
+
+		memset(&field, 0, sizeof(field));
+		memset(&type, 0, sizeof(type));
+
+		switch(c->type) {
+		case RES_TYPE_INTEGER:
+			fb_field(&field, 2, 1, TYPE_INT);
+			fb_field(&type, 0, 4, 64);  // bitWidth
+			fb_field(&type, 1, 1, 1);   // is_signed
+			break;
+		case RES_TYPE_FLOAT:
+			fb_field(&field, 2, 1, TYPE_FLOATING_POINT);
+			fb_field(&type, 0, 2, PRECISION_DOUBLE);
+			break;
+		case RES_TYPE_TIMESTAMP:
+			fb_field(&field, 2, 1, TYPE_TIMESTAMP);
+			fb_field(&type, 0, 2, UNIT_MICROSECOND);
+			break;
+		default:
+			fb_field(&field, 2, 1, TYPE_UTF8);
+			break;
+		}
+
+		fb_field(&field, 0, 4, 0);  // name
+		fb_field(&field, 1, 1, 1);  // nullable
+		fb_field(&field, 3, 4, 0);  // type
+		fb_field(&field, 5, 4, 0);  // children
+		fb_patch(b, fields + 4 + 4 * i, fb_end_table(b, &field));
+
+		fb_patch(b, field.pos[0], fb_string(b, c->name));
+		fb_patch(b, field.pos[3], fb_end_table(b, &type));
+		fb_patch(b, field.pos[5], fb_vector(b, 0, 4, 4));
+	}
+
+	write_message(w, &m, 0);
+}
+
+/*
+  The buffers a column's batch is made of: validity bitmap, then
+  offsets for strings, then values.
+*/
+static int column_buffers(column *c, long nrows, const unsigned char **data, size_t *len)
+{
+	int n;
+
+	n = 0;
+
+	data[n] = c->validity.buf;
+	len[n++] = (nrows + 7) / 8;
+
+	if(c->type == RES_TYPE_TEXT) {
+		data[n] = c->offsets.buf;
+		len[n++] = (nrows + 1) * 4;
+	}
+
+	data[n] = c->values.buf;
+	len[n++] = c->values.len;
+
+	return n;
+}
+
+static void write_batch(arrow_writer *w)
+{
+	static const char zeros[8];
+	bytes *b;
+	fb_table m, batch;
+	const unsigned char *data[3];
+	size_t len[3], nodes, buffers, pos, body;
+	column *c;
+	int i, j, k, n, nbuffers;
+
+	b = &w->fb;
+	pos = message_start(b, HEADER_RECORD_BATCH, &m);
+
+	memset(&batch, 0, sizeof(batch));
+	fb_field(&batch, 0, 8, w->nrows);
+	fb_field(&batch, 1, 4, 0);  // nodes
+	fb_field(&batch, 2, 4, 0);  // buffers
+	fb_patch(b, pos, fb_end_table(b, &batch));
+
+	// FieldNode { length, null_count }
+	nodes = fb_vector(b, w->ncols, 16, 8);
+	fb_patch(b, batch.pos[1], nodes);
+	for(i = 0; i < w->ncols; i++) {
+		fb_put(b, nodes + 4 + 16 * i, w->nrows, 8);
+		fb_put(b, nodes + 4 + 16 * i + 8, w->cols[i].nulls, 8);
+	}
+
+	nbuffers = 0;
+	for(i = 0; i < w->ncols; i++)
+		nbuffers += w->cols[i].type == RES_TYPE_TEXT ? 3 : 2;
+
+	// Buffer { offset, length } within the body
+	buffers = fb_vector(b, nbuffers, 16, 8);
+	fb_patch(b, batch.pos[2], buffers);
+	body = 0;
+	for(i = k = 0; i < w->ncols; i++) {
+		n = column_buffers(&w->cols[i], w->nrows, data, len);
+		for(j = 0; j < n; j++, k++) {
+			fb_put(b, buffers + 4 + 16 * k, body, 8);
+			fb_put(b, buffers + 4 + 16 * k + 8, len[j], 8);
+			body += PAD8(len[j]);
+		}
+	}
+
+	write_message(w, &m, body);
+
+	for(i = 0; i < w->ncols; i++) {
+		n = column_buffers(&w->cols[i], w->nrows, data, len);
+		for(j = 0; j < n; j++) {
+			stream_write_ref(w->s, (const char *) data[j], len[j]);
+			stream_write(w->s, zeros, PAD8(len[j]) - len[j]);
+		}
+	}
+
+	// the buffers are about to be reused
+	stream_flush(w->s);
+
+	for(i = 0; i < w->ncols; i++) {
+		c = &w->cols[i];
+		c->validity.len = c->offsets.len = c->values.len = 0;
+		c->nulls = 0;
+	}
+	w->nrows = 0;
+}
+
+/*
+  Add value v (null if 0) as row j of column c's batch.
+*/
+static void append(column *c, long j, const char *v)
+{
+	union { int64_t i; double f; } x;
+	size_t l;
+	int ok;
+
+	if(j % 8 == 0) *bytes_add(&c->validity, 1) = 0;
+
+	if(c->type == RES_TYPE_TEXT) {
+		if(!j) put_le(bytes_add(&c->offsets, 4), 0, 4);
+
+		if(v) {
+			l = strlen(v);
+			memcpy(bytes_add(&c->values, l), v, l);
+			c->validity.buf[j / 8] |= 1 << (j % 8);
+		} else c->nulls++;
+
+		put_le(bytes_add(&c->offsets, 4), c->values.len, 4);
+		return;
+	}
+
+	ok = 0;
+	x.i = 0;
+	if(v) {
+		switch(c->type) {
+		case RES_TYPE_INTEGER:   ok = parse_int(v, &x.i);       break;
+		case RES_TYPE_FLOAT:     ok = parse_float(v, &x.f);     break;
+		case RES_TYPE_TIMESTAMP: ok = parse_timestamp(v, &x.i); break;
+		default:                 break;
+		}
+
+		if(!ok) {
+			c->bad++;
+			x.i = 0;
+		}
+	}
+
+	if(ok) c->validity.buf[j / 8] |= 1 << (j % 8);
+	else c->nulls++;
+
+	put_le(bytes_add(&c->values, 8), x.i, 8);
+}
+
+static int parse_int(const char *p, int64_t *v)
+{
+	char *end;
+
+	errno = 0;
+	*v = strtoll(p, &end, 10);
+	return end != p && !*end && !errno;
+}
+
+/*
+  Drivers give floating point with a '.' whatever the locale, which
+  strtod() goes by.
+*/
+static int parse_float(const char *p, double *v)
+{
+	const char *point;
+	char buf[64], *end, *q;
+
+	point = localeconv()->decimal_point;
+	if(strcmp(point, ".") && strlen(point) == 1 && strlen(p) < sizeof(buf)) {
+		strcpy(buf, p);
+		if((q = strchr(buf, '.'))) *q = *point;
+		p = buf;
+	}
+
+	*v = strtod(p, &end);
+	return end != p && !*end;
+}
+
+static int digits(const char **p, int n, int *v)
+{
+	for(*v = 0; n--; (*p)++) {
+		if(**p < '0' || **p > '9') return 0;
+		*v = *v * 10 + **p - '0';
+	}
+
+	return 1;
+}
+
+// days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil(int y, int m, int d)
+{
+	int64_t era;
+	int yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/*
+  "YYYY-MM-DD", optionally followed by " HH:MM:SS" (or with a 'T') and
+  a fraction of a second, to microseconds since the epoch.
+*/
+static int parse_timestamp(const char *p, int64_t *v)
+{
+	int y, mo, d, h, mi, s, f, us, n;
+
+	if(!digits(&p, 4, &y) || *p++ != '-' || !digits(&p, 2, &mo) ||
+	   *p++ != '-' || !digits(&p, 2, &d))
+		return 0;
+
+	h = mi = s = us = 0;
+	if(*p == ' ' || *p == 'T') {
+		p++;
+		if(!digits(&p, 2, &h) || *p++ != ':' || !digits(&p, 2, &mi) ||
+		   *p++ != ':' || !digits(&p, 2, &s))
+			return 0;
+
+		if(*p == '.') {
+			p++;
+			for(n = 0; *p >= '0' && *p <= '9'; n++, p++)
+				if(n < 6) us = us * 10 + *p - '0';
+			if(!n) return 0;
+			for(f = n; f < 6; f++) us *= 10;
+		}
+	}
+
+	if(*p || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60)
+		return 0;
+
+	*v = ((days_from_civil(y, mo, d) * 24 + h) * 60 + mi) * 60 + s;
+	*v = *v * 1000000 + us;
+
+	return 1;
+}
+
+static uint64_t get_le(const unsigned char *p, int size)
+{
+	uint64_t v;
+
+	for(v = 0; size--; ) v = v << 8 | p[size];
+	return v;
+}
+
+/*
+  Reading FlatBuffers.  Anything out of bounds marks the reader bad and
+  reads as 0, so that a whole message can be picked apart before
+  checking whether it made sense.
+*/
+static int fbr_has(fb_reader *fb, size_t pos, size_t n)
+{
+	if(pos > fb->len || n > fb->len - pos) fb->bad = 1;
+	return !fb->bad;
+}
+
+static uint64_t fbr_get(fb_reader *fb, size_t pos, int size)
+{
+	return fbr_has(fb, pos, size) ? get_le(fb->buf + pos, size) : 0;
+}
+
+// what the offset at pos points to
+static size_t fbr_deref(fb_reader *fb, size_t pos)
+{
+	size_t target;
+
+	target = pos + fbr_get(fb, pos, 4);
+	return fbr_has(fb, target, 4) ? target : 0;
+}
+
+// where a table's field is, or 0 if it's absent
+static size_t fbr_field(fb_reader *fb, size_t table, int id)
+{
+	int64_t vtable;
+	size_t off;
+
+	if(!table) return 0;
+
+	vtable = (int64_t) table - (int32_t) fbr_get(fb, table, 4);
+	if(vtable < 0 || vtable > (int64_t) fb->len) fb->bad = 1;
+	if(fb->bad || fbr_get(fb, vtable, 2) < 4 + 2 * id + 2) return 0;
+
+	off = fbr_get(fb, vtable + 4 + 2 * id, 2);
+	return off && fbr_has(fb, table + off, 1) ? table + off : 0;
+}
+
+static uint64_t fbr_scalar(fb_reader *fb, size_t table, int id, int size, uint64_t def)
+{
+	size_t pos;
+
+	pos = fbr_field(fb, table, id);
+	return pos ? fbr_get(fb, pos, size) : def;
+}
+
+static size_t fbr_ref(fb_reader *fb, size_t table, int id)
+{
+	size_t pos;
+
+	pos = fbr_field(fb, table, id);
+	return pos ? fbr_deref(fb, pos) : 0;
+}
+
+// the length of a vector (or string) whose elements are the given size
+static size_t fbr_vector(fb_reader *fb, size_t vector, size_t size)
+{
+	uint64_t n;
+
+	if(!vector) return 0;
+
+	n = fbr_get(fb, vector, 4);
+	return fbr_has(fb, vector + 4, n * size) ? n : 0;
+}
+
+static void read_failed(arrow_reader *r)
+{
+	if(ferror(r->f)) printf(_("Failed to read Arrow stream: %s\n"), strerror(errno));
+	else puts(_("Truncated Arrow stream"));
+}
+
+/*
+  Read n bytes into b, a chunk at a time so that a bogus length runs
+  out of input before it runs out of memory.
+*/
+static int read_bytes(arrow_reader *r, bytes *b, size_t n)
+{
+	size_t chunk, got;
+
+	for(b->len = 0; n; n -= got) {
+		chunk = n < ARROW_READ_CHUNK ? n : ARROW_READ_CHUNK;
+		got = fread(bytes_add(b, chunk), 1, chunk, r->f);
+		b->len -= chunk - got;
+
+		if(got < chunk) {
+			read_failed(r);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+  Read a message's metadata and body, pointing fb at the metadata and
+  *header at its header.  Returns the header type, 0 at the end of the
+  stream or -1 on error.
+*/
+static int read_message(arrow_reader *r, fb_reader *fb, size_t *header)
+{
+	unsigned char prefix[4];
+	uint64_t len, body;
+	size_t message, got;
+	int type;
+
+	// a missing end-of-stream marker is fine
+	if(!(got = fread(prefix, 1, 4, r->f)) && !ferror(r->f)) return 0;
+	if(got < 4) {
+		read_failed(r);
+		return -1;
+	}
+
+	// before 0.15 there was no continuation marker
+	if((len = get_le(prefix, 4)) == 0xffffffff) {
+		if(fread(prefix, 1, 4, r->f) < 4) {
+			read_failed(r);
+			return -1;
+		}
+		len = get_le(prefix, 4);
+	}
+
+	if(!len) return 0;
+	if(len > INT32_MAX || !read_bytes(r, &r->metadata, len)) return -1;
+
+	fb->buf = r->metadata.buf;
+	fb->len = len;
+	fb->bad = 0;
+
+	message = fbr_deref(fb, 0);
+	type = fbr_scalar(fb, message, 1, 1, 0);
+	*header = fbr_ref(fb, message, 2);
+	body = fbr_scalar(fb, message, 3, 8, 0);
+
+	if(fb->bad || !type || !*header || body > SIZE_MAX / 2) {
+		puts(_("Malformed Arrow stream"));
+		return -1;
+	}
+
+	if(!read_bytes(r, &r->body, body)) return -1;
+
+	return type;
+}
+
+static int read_schema(arrow_reader *r)
+{
+	fb_reader fb;
+	size_t schema, fields;
+	int i, n;
+
+	if((n = read_message(r, &fb, &schema)) < 0) return 0;
+	if(n != HEADER_SCHEMA) {
+		puts(_("Not an Arrow stream"));
+		return 0;
+	}
+
+	if((fbr_scalar(&fb, schema, 0, 2, 0) == 0) != host_little_endian()) {
+		puts(_("Arrow streams in the other byte order can't be loaded"));
+		return 0;
+	}
+
+	fields = fbr_ref(&fb, schema, 1);
+	n = fbr_vector(&fb, fields, 4);
+	if(fb.bad || !n) {
+		puts(_("Malformed Arrow stream"));
+		return 0;
+	}
+
+	if(!(r->cols = calloc(n, sizeof(arrow_column)))) err_system();
+	r->ncols = n;
+
+	for(i = 0; i < n; i++)
+		if(!read_field(&fb, fbr_deref(&fb, fields + 4 + 4 * i), &r->cols[i]))
+			return 0;
+
+	return 1;
+}
+
+static int read_field(fb_reader *fb, size_t field, arrow_column *c)
+{
+	size_t name, type, l;
+	int ok, bits;
+
+	name = fbr_ref(fb, field, 0);
+	l = fbr_vector(fb, name, 1);
+	if(fb->bad) {
+		puts(_("Malformed Arrow stream"));
+		return 0;
+	}
+
+	if(!(c->name = malloc(l + 1))) err_system();
+	if(l) memcpy(c->name, fb->buf + name + 4, l);
+	c->name[l] = 0;
+
+	ok = 1;
+	type = fbr_ref(fb, field, 3);
+
+	switch(fbr_scalar(fb, field, 2, 1, 0)) {
+	case TYPE_INT:
+		c->type = ARROW_TYPE_INT;
+		bits = fbr_scalar(fb, type, 0, 4, 0);
+		c->width = bits / 8;
+		c->is_signed = fbr_scalar(fb, type, 1, 1, 0);
+		ok = bits == 8 || bits == 16 || bits == 32 || bits == 64;
+		break;
+	case TYPE_FLOATING_POINT:
+		c->type = ARROW_TYPE_FLOAT;
+		switch(fbr_scalar(fb, type, 0, 2, 0)) {
+		case PRECISION_SINGLE: c->width = 4; break;
+		case PRECISION_DOUBLE: c->width = 8; break;
+		default:               ok = 0;       break;
+		}
+		break;
+	case TYPE_BOOL:
+		c->type = ARROW_TYPE_BOOL;
+		break;
+	case TYPE_UTF8:
+	case TYPE_LARGE_UTF8:
+		c->type = ARROW_TYPE_UTF8;
+		c->width = fbr_scalar(fb, field, 2, 1, 0) == TYPE_UTF8 ? 4 : 8;
+		break;
+	case TYPE_BINARY:
+	case TYPE_LARGE_BINARY:
+		c->type = ARROW_TYPE_BINARY;
+		c->width = fbr_scalar(fb, field, 2, 1, 0) == TYPE_BINARY ? 4 : 8;
+		break;
+	case TYPE_DATE:
+		c->type = ARROW_TYPE_DATE;
+		c->unit = fbr_scalar(fb, type, 0, 2, 1);  // milliseconds by default
+		c->width = c->unit ? 8 : 4;
+		ok = c->unit <= 1;
+		break;
+	case TYPE_TIMESTAMP:
+		c->type = ARROW_TYPE_TIMESTAMP;
+		c->unit = fbr_scalar(fb, type, 0, 2, 0);
+		c->width = 8;
+		ok = c->unit <= UNIT_NANOSECOND;
+		break;
+	default:
+		ok = 0;
+	}
+
+	// dictionary-encoded
+	if(fbr_field(fb, field, 4)) ok = 0;
+
+	if(fb->bad) {
+		puts(_("Malformed Arrow stream"));
+		return 0;
+	} else if(!ok) {
+		printf(_("Column %s has an Arrow type that can't be loaded\n"), c->name);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+  Check a column's node and buffers (starting at buffer *k, which is
+  moved past them) in a batch of length rows, and point it at its
+  values.
+*/
+static int read_column(arrow_reader *r, fb_reader *fb, arrow_column *c, long length,
+		       size_t node, size_t buffers, size_t nbuffers, size_t *k)
+{
+	const unsigned char *data[3];
+	uint64_t offset, len[3], prev, next;
+	long j;
+	int i, n;
+
+	if(fbr_get(fb, node, 8) != length) return 0;
+
+	n = c->type == ARROW_TYPE_UTF8 || c->type == ARROW_TYPE_BINARY ? 3 : 2;
+	if(*k + n > nbuffers) return 0;
+
+	for(i = 0; i < n; i++, (*k)++) {
+		offset = fbr_get(fb, buffers + 16 * *k, 8);
+		len[i] = fbr_get(fb, buffers + 16 * *k + 8, 8);
+		if(offset > r->body.len || len[i] > r->body.len - offset) return 0;
+		data[i] = r->body.buf + offset;
+	}
+
+	// there needn't be a bitmap if there are no nulls
+	if(len[0]) {
+		if(len[0] < (length + 7) / 8) return 0;
+		c->validity = data[0];
+	} else {
+		if(fbr_get(fb, node + 8, 8)) return 0;
+		c->validity = 0;
+	}
+
+	if(n == 2) {
+		c->values = data[1];
+		if(c->type == ARROW_TYPE_BOOL) return len[1] >= (length + 7) / 8;
+		return len[1] >= length * c->width && (uintptr_t) data[1] % c->width == 0;
+	}
+
+	c->offsets = data[1];
+	c->values = data[2];
+	if(!length) return 1;
+
+	if(len[1] < (length + 1) * c->width) return 0;
+
+	prev = get_le(data[1], c->width);
+	for(j = 1; j <= length; j++, prev = next)
+		if((next = get_le(data[1] + j * c->width, c->width)) < prev) return 0;
+
+	return prev <= len[2];
+}
+
+static int host_little_endian()
+{
+	uint16_t x = 1;
+
+	return *(unsigned char *) &x;
+}
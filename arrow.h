@@ -0,0 +1,69 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARROW_H
+#define ARROW_H
+
+#include <stdio.h>
+
+typedef enum {
+	ARROW_TYPE_INT,
+	ARROW_TYPE_FLOAT,
+	ARROW_TYPE_BOOL,
+	ARROW_TYPE_UTF8,
+	ARROW_TYPE_BINARY,
+	ARROW_TYPE_DATE,
+	ARROW_TYPE_TIMESTAMP
+} arrow_type;
+
+/*
+  A column of a stream being read, and where its values are in the
+  current batch.  width is that of each value (or, for UTF8 and BINARY,
+  of each offset; see arrow_value()).  unit is Arrow's: for timestamps
+  0-3 for seconds to nanoseconds, and for dates 0 for days and 1 for
+  milliseconds.  Values are in host byte order.
+*/
+typedef struct {
+	char *name;
+	arrow_type type;
+	int width;
+	int is_signed;
+	int unit;
+	const unsigned char *validity;  // 0 if there are no nulls
+	const unsigned char *offsets;
+	const unsigned char *values;
+} arrow_column;
+
+#define ARROW_IS_VALID(c, j) \
+	(!(c)->validity || ((c)->validity[(j) / 8] & (1 << ((j) % 8))))
+
+#define ARROW_IS_BIT_SET(c, j) \
+	(((c)->values[(j) / 8] >> ((j) % 8)) & 1)
+
+arrow_writer *arrow_writer_create(results *, stream *);
+void arrow_writer_row(arrow_writer *, char **);
+void arrow_writer_finish(arrow_writer *);
+
+arrow_reader *arrow_reader_open(FILE *);
+int arrow_reader_ncols(arrow_reader *);
+const arrow_column *arrow_reader_column(arrow_reader *, int);
+long arrow_reader_next(arrow_reader *);
+const unsigned char *arrow_value(const arrow_column *, long, size_t *);
+void arrow_reader_free(arrow_reader *);
+
+#endif
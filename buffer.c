@@ -23,6 +23,7 @@
 #include "common.h"
 #include "buffer.h"
 #include "err.h"
+#include "mem.h"
 
 buffer *buffer_alloc(size_t len)
 {
@@ -34,12 +35,15 @@ buffer *buffer_alloc(size_t len)
 	b->len  = len;
 	b->next = 0;
 
+	mem_add(MEM_BUFFERS, len);
+
 	return b;
 }
 
 void buffer_realloc(buffer *buf, size_t len)
 {
 	if(!(buf->buf = realloc(buf->buf, len))) err_system();
+	mem_add(MEM_BUFFERS, (ssize_t) len - (ssize_t) buf->len);
 	buf->len = len;
 }
 
@@ -62,6 +66,7 @@ char *buffer_dup2str(buffer *b)
 
 void buffer_free(buffer *b)
 {
+	mem_sub(MEM_BUFFERS, b->len);
 	free(b->buf);
 	free(b);
 }
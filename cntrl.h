@@ -16,7 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-wchar_t cntrl[][33] = {
+static const wchar_t cntrl[][33] = {
 	L"*NULL*",    // 0x00  (special case - NULL pointer, not NULL character)
 	L"<01>",      // 0x01
 	L"<02>",      // 0x02
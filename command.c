@@ -29,6 +29,7 @@
 #include "gplv3.h"
 #include "help.h"
 #include "err.h"
+#include "mem.h"
 #include "parser.h"
 #include "rc.h"
 #include "results.h"
@@ -81,6 +82,58 @@ static results *autocommit(const char *state)
 	return db_autocommit(change);
 }
 
+static results *timing(const char *state)
+{
+	results *res;
+	const char *current;
+
+	if(state) {
+		if(!strcmp(state, "Off") ||
+		   !strcmp(state, "off") ||
+		   !strcmp(state, "0")) state = "off";
+		else state = "on";
+	} else {
+		current = getenv("DBSH_TIMING");
+		if(current && (!strcmp(current, "Off") ||
+			       !strcmp(current, "off") ||
+			       !strcmp(current, "0"))) current = 0;
+		state = current ? "off" : "on";
+	}
+
+	if(setenv("DBSH_TIMING", state, 1) == -1) err_system();
+
+	res = res_alloc();
+	res_set_cols(res, 1, _("Timing state"));
+	res_add_row(res, strcmp(state, "on") ? _("Off") : _("On"));
+
+	return res;
+}
+
+static void add_mem_row(results *res, const char *name, size_t bytes)
+{
+	char buf[16];
+
+	mem_format(buf, sizeof(buf), bytes);
+	res_add_row(res, name, buf);
+}
+
+static results *mem()
+{
+	results *res = res_alloc();
+	size_t limit;
+
+	res_set_cols(res, 2, _("name"), _("bytes"));
+	add_mem_row(res, _("results"), mem_usage(MEM_RESULTS));
+	add_mem_row(res, _("buffers"), mem_usage(MEM_BUFFERS));
+	add_mem_row(res, _("caches"),  mem_usage(MEM_CACHES));
+	add_mem_row(res, _("spilled to disk"), mem_usage(MEM_SPILLED));
+
+	if((limit = mem_limit())) add_mem_row(res, _("result limit"), limit);
+	else res_add_row(res, _("result limit"), _("(none)"));
+
+	return res;
+}
+
 static results *set(const char *name, const char *value)
 {
 	results *res = res_alloc();
@@ -147,6 +200,22 @@ static void unset(const char *name)
 	free(prefixed_name);
 }
 
+static results *load(const char *table, const char *file)
+{
+	results *res;
+	FILE *f;
+
+	if(!(f = fopen(file, "r"))) {
+		printf(_("Failed to open %s: %s\n"), file, strerror(errno));
+		return 0;
+	}
+
+	res = db_load_arrow(table, f);
+	fclose(f);
+
+	return res;
+}
+
 #define SYNTAX(p) printf(_("Syntax: %s %s\n"), c, p)
 
 results *run_command(buffer *buf)
@@ -196,6 +265,13 @@ results *run_command(buffer *buf)
 		else SYNTAX(_("<variable>"));
 	} else if(!strncmp(c, "inf", 3)) {
 		res = db_conn_details();
+	} else if(!strcmp(c, "timing")) {
+		res = timing(p1);
+	} else if(!strcmp(c, "mem")) {
+		res = mem();
+	} else if(!strcmp(c, "load")) {
+		if(p1 && p2) res = load(p1, p2);
+		else SYNTAX(_("<table> <file>"));
 	}
 
 	else printf(_("Unrecognised command: %s\n"), c);
@@ -25,7 +25,12 @@
 
 #define _(String) gettext(String)
 
+typedef struct arrow_reader arrow_reader;
+typedef struct arrow_writer arrow_writer;
+typedef struct block_pool block_pool;
 typedef struct buffer buffer;
+typedef struct compressor compressor;
+typedef struct formatter formatter;
 typedef struct parsed_line parsed_line;
 typedef struct results results;
 typedef struct stream stream;
@@ -0,0 +1,256 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  In-process compression for redirects to .gz and .zst files.  The
+  output is cut into independent blocks which a pool of threads
+  compresses in parallel, each into a complete gzip member or zstd
+  frame; concatenations of those are valid files, so the blocks can be
+  written out one after another, in order, as they're finished.
+
+  The calling thread fills blocks and writes out finished ones; the
+  workers (see pool.c) only compress.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "common.h"
+#include "compress.h"
+#include "err.h"
+#include "mem.h"
+#include "pool.h"
+
+#define COMPRESS_BLOCK_SIZE (1024 * 1024)
+
+
+typedef struct {
+	char *in;
+	size_t in_len;
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+	size_t accounted;
+} block;
+
+struct compressor {
+	compress_type type;
+	int fd;
+	size_t written;
+	block_pool *pool;
+	block *blocks;
+	int nblocks;
+	int current;  // the block being filled
+};
+
+
+static void compress_block(void *, int);
+static void write_out(void *, int);
+
+
+/*
+  The type of compression implied by a file name, or COMPRESS_NONE if
+  it doesn't call for any that we support.
+*/
+compress_type compress_type_for(const char *name)
+{
+	size_t l;
+
+	l = strlen(name);
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+	if(l > 3 && !strcmp(name + l - 3, ".gz")) return COMPRESS_GZIP;
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+	if(l > 4 && !strcmp(name + l - 4, ".zst")) return COMPRESS_ZSTD;
+#endif
+
+	return COMPRESS_NONE;
+}
+
+compressor *compress_create(int fd, compress_type type)
+{
+	compressor *c;
+	int threads, i;
+
+	if(!(c = calloc(1, sizeof(compressor)))) err_system();
+
+	c->type = type;
+	c->fd = fd;
+	threads = pool_threads("DBSH_COMPRESS_THREADS");
+	c->nblocks = threads * 2;
+
+	if(!(c->blocks = calloc(c->nblocks, sizeof(block)))) err_system();
+	for(i = 0; i < c->nblocks; i++)
+		if(!(c->blocks[i].in = malloc(COMPRESS_BLOCK_SIZE))) err_system();
+	mem_add(MEM_BUFFERS, c->nblocks * COMPRESS_BLOCK_SIZE);
+
+	c->pool = pool_create(threads, c->nblocks, compress_block, write_out, c);
+
+	return c;
+}
+
+void compress_write(compressor *c, const char *data, size_t len)
+{
+	block *b;
+	size_t n;
+
+	while(len) {
+		b = &c->blocks[c->current];
+
+		n = COMPRESS_BLOCK_SIZE - b->in_len;
+		if(n > len) n = len;
+
+		memcpy(b->in + b->in_len, data, n);
+		b->in_len += n;
+		data += n;
+		len -= n;
+
+		if(b->in_len == COMPRESS_BLOCK_SIZE) c->current = pool_submit(c->pool);
+	}
+}
+
+/*
+  Compress and write whatever's left, stop the workers and free
+  everything.  Returns the number of (compressed) bytes written.
+*/
+size_t compress_finish(compressor *c)
+{
+	size_t written;
+	int i;
+
+	if(c->blocks[c->current].in_len) pool_submit(c->pool);
+	pool_finish(c->pool);
+
+	for(i = 0; i < c->nblocks; i++) {
+		free(c->blocks[i].in);
+		free(c->blocks[i].out);
+		mem_sub(MEM_BUFFERS, c->blocks[i].accounted);
+	}
+	mem_sub(MEM_BUFFERS, c->nblocks * COMPRESS_BLOCK_SIZE);
+	free(c->blocks);
+
+	written = c->written;
+	free(c);
+
+	return written;
+}
+
+
+/*
+  Write out block i, now that it's been compressed.
+*/
+static void write_out(void *arg, int i)
+{
+	compressor *c;
+	block *b;
+	const char *p;
+	ssize_t n;
+	size_t l;
+
+	c = arg;
+	b = &c->blocks[i];
+
+	mem_add(MEM_BUFFERS, b->out_cap - b->accounted);
+	b->accounted = b->out_cap;
+
+	for(p = b->out, l = b->out_len; l; p += n, l -= n) {
+		if((n = write(c->fd, p, l)) == -1) {
+			if(errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			break;  // as with stdio, write errors are dropped
+		}
+		c->written += n;
+	}
+
+	b->in_len = 0;
+}
+
+/*
+  Runs in a worker, so it mustn't touch anything but block i: memory
+  accounting for the output buffer is left to write_out().
+*/
+static void compress_block(void *arg, int i)
+{
+	compressor *c;
+	block *b;
+	size_t bound;
+
+	c = arg;
+	b = &c->blocks[i];
+
+	switch(c->type) {
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+	case COMPRESS_GZIP: {
+		z_stream z;
+
+		memset(&z, 0, sizeof(z));
+		// 16 + 15: a gzip wrapper round a full-sized window
+		if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8,
+				Z_DEFAULT_STRATEGY) != Z_OK) err_fatal(_("Failed to start compression"));
+
+		bound = deflateBound(&z, b->in_len);
+		if(bound > b->out_cap) {
+			free(b->out);
+			if(!(b->out = malloc(bound))) err_system();
+			b->out_cap = bound;
+		}
+
+		z.next_in = (Bytef *) b->in;
+		z.avail_in = b->in_len;
+		z.next_out = (Bytef *) b->out;
+		z.avail_out = b->out_cap;
+
+		if(deflate(&z, Z_FINISH) != Z_STREAM_END) err_fatal(_("Compression failed"));
+		b->out_len = z.total_out;
+		deflateEnd(&z);
+		break;
+	}
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+	case COMPRESS_ZSTD:
+		bound = ZSTD_compressBound(b->in_len);
+		if(bound > b->out_cap) {
+			free(b->out);
+			if(!(b->out = malloc(bound))) err_system();
+			b->out_cap = bound;
+		}
+
+		b->out_len = ZSTD_compress(b->out, b->out_cap, b->in, b->in_len, 3);
+		if(ZSTD_isError(b->out_len)) err_fatal(_("Compression failed"));
+		break;
+#endif
+	default:
+		bound = 0;
+		b->out_len = 0;
+		break;
+	}
+}
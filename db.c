@@ -22,26 +22,68 @@
 #include <string.h>
 
 #include "common.h"
+#include "arrow.h"
 #include "buffer.h"
 #include "db.h"
 #include "err.h"
+#include "mem.h"
 #include "parser.h"
 #include "results.h"
 
 #define report_error(t, h, r, f) _report_error(t, h, r, f, __FILE__, __LINE__)
 
+#define LOAD_ROWS 4096
+#define LOAD_BUFFER_SIZE (16 * 1024 * 1024)
+
 extern const char *dsn, *user, *pass;
 SQLHDBC conn;
 
 SQLHSTMT *current_statement;
 pthread_mutex_t cs_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+  A statement whose results are being fetched, either all at once by
+  fetch_results() or row by row as they're output (see
+  res_set_source()).
+*/
+typedef struct {
+	SQLHSTMT st;
+	buffer *buf;
+	size_t limit;
+	int done;
+} query;
+
+/*
+  A column's parameters for the rows being loaded: ind, and buf for
+  values that ODBC can't take where they are in the Arrow batch.
+*/
+typedef struct {
+	SQLLEN *ind;
+	char *buf;
+	size_t cap;
+} load_param;
+
 
 static void set_current_statement(SQLHSTMT *);
 static void fetch_warnings(results *, SQLSMALLINT, SQLHANDLE);
 static void fetch_results(results *, SQLHSTMT);
-static void fetch_resultset(results *, SQLHSTMT, buffer *);
+static query *query_open(results *, SQLHSTMT);
+static int query_fetch_row(results *, void *);
+static int query_next_set(results *, void *);
+static void query_close(results *, void *);
+static int describe_resultset(results *, SQLHSTMT, buffer *);
 static int fetch_row(results *, SQLHSTMT, buffer *);
+static char *load_statement(const char *, arrow_reader *);
+static long load_rows(arrow_reader *, long, long);
+static void count_loaded(const SQLUSMALLINT *, SQLULEN, long *, long *);
+static SQLRETURN bind_load_param(SQLHSTMT, int, const arrow_column *,
+				 load_param *, long, long);
+
+static const res_source query_source = {
+	query_fetch_row,
+	query_next_set,
+	query_close
+};
 static char *get_current_catalog();
 static void parse_catalog_spec(char *, char **, char **);
 static void parse_qualified_table(char *, char **, char **);
@@ -348,7 +390,9 @@ results *execute_query(const char *buf, int buflen, parsed_line *params)
 	res = res_alloc();
 	res_start_timer(res);
 
+	res_phase_start(res, RES_PHASE_PREPARE);
 	r = SQLPrepare(st, (SQLCHAR *) buf, buflen);
+	res_phase_stop(res, RES_PHASE_PREPARE);
 	if(!SQL_SUCCEEDED(r)) {
 		report_error(SQL_HANDLE_STMT, st, r, _("Failed to prepare statement"));
 		SQLFreeHandle(SQL_HANDLE_STMT, st);
@@ -373,7 +417,10 @@ results *execute_query(const char *buf, int buflen, parsed_line *params)
 		}
 	}
 
+	res_phase_start(res, RES_PHASE_FIRST_ROW);
+	res_phase_start(res, RES_PHASE_EXECUTE);
 	r = SQLExecute(st);
+	res_phase_stop(res, RES_PHASE_EXECUTE);
 	if(!SQL_SUCCEEDED(r) && r != SQL_NO_DATA) {
 		report_error(SQL_HANDLE_STMT, st, r, _("Failed to execute statement"));
 		SQLFreeHandle(SQL_HANDLE_STMT, st);
@@ -383,8 +430,8 @@ results *execute_query(const char *buf, int buflen, parsed_line *params)
 		fetch_warnings(res, SQL_HANDLE_STMT, st);
 	}
 
-	fetch_results(res, st);
-	res_stop_timer(res);
+	// rows are fetched as the output asks for them
+	res_set_source(res, &query_source, query_open(res, st));
 
 	return res;
 }
@@ -426,35 +473,111 @@ static void fetch_warnings(results *res, SQLSMALLINT type, SQLHANDLE h)
 
 void fetch_results(results *res, SQLHSTMT st)
 {
-	buffer *buf;
-	SQLRETURN r;
+	query *q;
 
-	buf = buffer_alloc(1024);
+	q = query_open(res, st);
 
-	for(;;) {
-		fetch_resultset(res, st, buf);
+	do {
+		while(query_fetch_row(res, q));
+	} while(query_next_set(res, q));
 
-		r = SQLMoreResults(st);
+	query_close(res, q);
+}
 
-		if(r == SQL_NO_DATA) {
-			break;
-		} else if(!SQL_SUCCEEDED(r)) {
-			fetch_warnings(res, SQL_HANDLE_STMT, st);
-			break;
-		} else if(r == SQL_SUCCESS_WITH_INFO) {
-			fetch_warnings(res, SQL_HANDLE_STMT, st);
-		}
+/*
+  Take over statement st, which has just been executed, and describe
+  its first result set.
+*/
+static query *query_open(results *res, SQLHSTMT st)
+{
+	query *q;
 
-		res_add_set(res);
+	if(!(q = malloc(sizeof(query)))) err_system();
+
+	q->st = st;
+	q->buf = buffer_alloc(1024);
+	q->limit = mem_limit();
+	set_current_statement(&q->st);
+
+	q->done = !describe_resultset(res, q->st, q->buf);
+
+	return q;
+}
+
+static int query_fetch_row(results *res, void *arg)
+{
+	query *q;
+	char msg[128], lim[16];
+
+	q = arg;
+	if(q->done) return 0;
+
+	if(!fetch_row(res, q->st, q->buf)) {
+		q->done = 1;
+		return 0;
 	}
 
-	buffer_free(buf);
+	if(q->limit && mem_usage(MEM_RESULTS) > q->limit) {
+		mem_format(lim, sizeof(lim), q->limit);
+		snprintf(msg, sizeof(msg),
+			 _("Result memory limit (%s) reached, "
+			   "stopped fetching after %d rows"),
+			 lim, res_get_nrows(res));
+		res_add_warning(res, msg);
+		q->done = 1;
+	} else if(res_spill_full(res)) {
+		snprintf(msg, sizeof(msg),
+			 _("No room left to spill results to disk, "
+			   "stopped fetching after %d rows"),
+			 res_get_nrows(res));
+		res_add_warning(res, msg);
+		q->done = 1;
+	}
+
+	return 1;
+}
+
+static int query_next_set(results *res, void *arg)
+{
+	query *q;
+	SQLRETURN r;
+
+	q = arg;
+
+	r = SQLMoreResults(q->st);
+
+	if(r == SQL_NO_DATA) {
+		return 0;
+	} else if(!SQL_SUCCEEDED(r)) {
+		fetch_warnings(res, SQL_HANDLE_STMT, q->st);
+		return 0;
+	} else if(r == SQL_SUCCESS_WITH_INFO) {
+		fetch_warnings(res, SQL_HANDLE_STMT, q->st);
+	}
+
+	res_add_set(res);
+	q->done = !describe_resultset(res, q->st, q->buf);
+
+	return 1;
+}
+
+static void query_close(results *res, void *arg)
+{
+	query *q;
+
+	q = arg;
 
+	buffer_free(q->buf);
 	set_current_statement(0);
-	SQLFreeHandle(SQL_HANDLE_STMT, st);
+	SQLFreeHandle(SQL_HANDLE_STMT, q->st);
+	free(q);
 }
 
-void fetch_resultset(results *res, SQLHSTMT st, buffer *buf)
+/*
+  Set up the columns of the current result set (or its row count, for
+  non-SELECTs).  Returns 1 if there are rows to fetch.
+*/
+static int describe_resultset(results *res, SQLHSTMT st, buffer *buf)
 {
 	SQLSMALLINT ncols, i, reqlen;
 	SQLLEN nrows;
@@ -463,7 +586,7 @@ void fetch_resultset(results *res, SQLHSTMT st, buffer *buf)
 	r = SQLNumResultCols(st, &ncols);
 	if(!SQL_SUCCEEDED(r)) {
 		report_error(SQL_HANDLE_STMT, st, r, _("Failed to retrieve number of columns"));
-		return;
+		return 0;
 	}
 	res_set_ncols(res, ncols);
 
@@ -471,11 +594,11 @@ void fetch_resultset(results *res, SQLHSTMT st, buffer *buf)
 		r = SQLRowCount(st, &nrows);
 		if(!SQL_SUCCEEDED(r)) {
 			report_error(SQL_HANDLE_STMT, st, r, _("Failed to retrieve rows affected"));
-			return;
+			return 0;
 		}
 
 		res_set_nrows(res, nrows);
-		return;
+		return 0;
 	}
 
 	for(i = 0; i < ncols; i++) {
@@ -495,14 +618,35 @@ void fetch_resultset(results *res, SQLHSTMT st, buffer *buf)
 
 		if(!SQL_SUCCEEDED(r)) {
 			report_error(SQL_HANDLE_STMT, st, r, _("Failed to retrieve column data"));
-			return;
+			return 0;
 		}
 
 		res_set_col(res, i, buf->buf);
-	}
 
+		switch(type) {
+		case SQL_TINYINT:
+		case SQL_SMALLINT:
+		case SQL_INTEGER:
+		case SQL_BIGINT:
+			res_set_col_type(res, i, RES_TYPE_INTEGER);
+			break;
+		case SQL_REAL:
+		case SQL_FLOAT:
+		case SQL_DOUBLE:
+			res_set_col_type(res, i, RES_TYPE_FLOAT);
+			break;
+		case SQL_DECIMAL:
+		case SQL_NUMERIC:
+			res_set_col_type(res, i, RES_TYPE_DECIMAL);
+			break;
+		case SQL_TIMESTAMP:
+		case SQL_TYPE_TIMESTAMP:
+			res_set_col_type(res, i, RES_TYPE_TIMESTAMP);
+			break;
+		}
+	}
 
-	while(fetch_row(res, st, buf));
+	return 1;
 }
 
 static int fetch_row(results *res, SQLHSTMT st, buffer *buf)
@@ -512,14 +656,18 @@ static int fetch_row(results *res, SQLHSTMT st, buffer *buf)
 	SQLLEN reqlen, offset;
 
 
+	res_phase_start(res, RES_PHASE_FETCH);
 	r = SQLFetch(st);
+	res_phase_stop(res, RES_PHASE_FETCH);
 	if(!SQL_SUCCEEDED(r)) return 0;
 
+	res_phase_stop(res, RES_PHASE_FIRST_ROW);
 	res_new_row(res);
 
 	for(i = 0; i < res_get_ncols(res); i++) {
 		offset = 0;
 
+		res_phase_start(res, RES_PHASE_FETCH);
 		for(;;) {
 			r = SQLGetData(st, i + 1, SQL_C_CHAR,
 				       buf->buf + offset, buf->len - offset,
@@ -527,6 +675,7 @@ static int fetch_row(results *res, SQLHSTMT st, buffer *buf)
 
 			if(r == SQL_NO_DATA) break;
 			else if(!SQL_SUCCEEDED(r)) {
+				res_phase_stop(res, RES_PHASE_FETCH);
 				report_error(SQL_HANDLE_STMT, st, r, _("Failed to fetch row"));
 				return 0;
 			}
@@ -539,8 +688,13 @@ static int fetch_row(results *res, SQLHSTMT st, buffer *buf)
 				buffer_realloc(buf, reqlen + 1);
 			} else break;
 		}
+		res_phase_stop(res, RES_PHASE_FETCH);
 
-		if(reqlen != SQL_NULL_DATA) res_set_value(res, i, buf->buf);
+		if(reqlen != SQL_NULL_DATA) {
+			res_phase_start(res, RES_PHASE_CONVERT);
+			res_set_value(res, i, buf->buf);
+			res_phase_stop(res, RES_PHASE_CONVERT);
+		}
 	}
 
 	return 1;
@@ -560,6 +714,401 @@ void db_cancel_query()
 	pthread_mutex_unlock(&cs_lock);
 }
 
+/*
+  Insert the rows of the Arrow stream read from f into table, naming
+  the stream's columns, with as many rows per SQLExecute() as
+  load_rows() allows.
+*/
+results *db_load_arrow(const char *table, FILE *f)
+{
+	arrow_reader *r;
+	load_param *params;
+	results *res;
+	SQLHSTMT st;
+	SQLRETURN ret;
+	SQLUSMALLINT *status;
+	SQLULEN processed;
+	char *sql, msg[128];
+	long n, start, rows, total, failed;
+	int i, ncols, ok;
+
+	if(!(r = arrow_reader_open(f))) return 0;
+	ncols = arrow_reader_ncols(r);
+
+	ret = SQLAllocHandle(SQL_HANDLE_STMT, conn, &st);
+	if(!SQL_SUCCEEDED(ret)) {
+		puts(_("Failed to allocate statement handle"));
+		arrow_reader_free(r);
+		return 0;
+	}
+
+	set_current_statement(&st);
+
+	res = res_alloc();
+	res_start_timer(res);
+
+	sql = load_statement(table, r);
+	ret = SQLPrepare(st, (SQLCHAR *) sql, SQL_NTS);
+	free(sql);
+
+	if(!(ok = SQL_SUCCEEDED(ret)))
+		report_error(SQL_HANDLE_STMT, st, ret, _("Failed to prepare statement"));
+	else if(ret == SQL_SUCCESS_WITH_INFO)
+		fetch_warnings(res, SQL_HANDLE_STMT, st);
+
+	SQLSetStmtAttr(st, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER) SQL_PARAM_BIND_BY_COLUMN, 0);
+
+	// which rows of each batch went in, for drivers that say
+	if(!(status = malloc(LOAD_ROWS * sizeof(SQLUSMALLINT)))) err_system();
+	SQLSetStmtAttr(st, SQL_ATTR_PARAM_STATUS_PTR, status, 0);
+	SQLSetStmtAttr(st, SQL_ATTR_PARAMS_PROCESSED_PTR, &processed, 0);
+
+	if(!(params = calloc(ncols, sizeof(load_param)))) err_system();
+	for(i = 0; i < ncols; i++)
+		if(!(params[i].ind = malloc(LOAD_ROWS * sizeof(SQLLEN)))) err_system();
+
+	n = total = failed = 0;
+	while(ok && (n = arrow_reader_next(r)) > 0) {
+		for(start = 0; ok && start < n; start += rows) {
+			rows = load_rows(r, start, n);
+
+			for(i = 0; ok && i < ncols; i++) {
+				ret = bind_load_param(st, i, arrow_reader_column(r, i),
+						      &params[i], start, rows);
+				if(!(ok = SQL_SUCCEEDED(ret)))
+					report_error(SQL_HANDLE_STMT, st, ret, _("Failed to bind parameter"));
+			}
+			if(!ok) break;
+
+			SQLSetStmtAttr(st, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER) rows, 0);
+
+			// as if every row went in, should the driver not say
+			processed = rows;
+			for(i = 0; i < rows; i++) status[i] = SQL_PARAM_SUCCESS;
+
+			ret = SQLExecute(st);
+			count_loaded(status, processed, &total, &failed);
+
+			if(!(ok = SQL_SUCCEEDED(ret))) {
+				report_error(SQL_HANDLE_STMT, st, ret, _("Failed to execute statement"));
+				break;
+			}
+
+			if(ret == SQL_SUCCESS_WITH_INFO)
+				fetch_warnings(res, SQL_HANDLE_STMT, st);
+		}
+	}
+
+	set_current_statement(0);
+	SQLFreeHandle(SQL_HANDLE_STMT, st);
+
+	for(i = 0; i < ncols; i++) {
+		free(params[i].ind);
+		mem_sub(MEM_BUFFERS, params[i].cap);
+		free(params[i].buf);
+	}
+	free(params);
+	free(status);
+	arrow_reader_free(r);
+
+	if(!ok || n < 0) {
+		if(total)
+			printf(ngettext("%ld row was loaded before the error\n",
+					"%ld rows were loaded before the error\n",
+					total),
+			       total);
+		if(failed)
+			printf(ngettext("%ld row failed to load\n",
+					"%ld rows failed to load\n",
+					failed),
+			       failed);
+		res_free(res);
+		return 0;
+	}
+
+	if(failed) {
+		snprintf(msg, sizeof(msg),
+			 ngettext("%ld row failed to load",
+				  "%ld rows failed to load",
+				  failed),
+			 failed);
+		res_add_warning(res, msg);
+	}
+
+	res_set_nrows(res, total);
+	res_stop_timer(res);
+
+	return res;
+}
+
+static char *load_statement(const char *table, arrow_reader *r)
+{
+	SQLCHAR quote[8];
+	SQLRETURN ret;
+	const char *name;
+	char *sql, *p;
+	size_t len;
+	int i, ncols;
+
+	// a space if the driver doesn't quote identifiers
+	ret = SQLGetInfo(conn, SQL_IDENTIFIER_QUOTE_CHAR, quote, sizeof(quote), 0);
+	if(!SQL_SUCCEEDED(ret) || *quote == ' ') *quote = 0;
+
+	ncols = arrow_reader_ncols(r);
+
+	len = strlen(table) + 32;
+	for(i = 0; i < ncols; i++) len += 2 * strlen(arrow_reader_column(r, i)->name) + 6;
+	if(!(sql = malloc(len))) err_system();
+
+	p = sql + sprintf(sql, "INSERT INTO %s (", table);
+
+	for(i = 0; i < ncols; i++) {
+		if(i) *p++ = ',';
+		if(*quote) *p++ = *quote;
+
+		for(name = arrow_reader_column(r, i)->name; *name; name++) {
+			if(*name == *quote) *p++ = *quote;
+			*p++ = *name;
+		}
+
+		if(*quote) *p++ = *quote;
+	}
+
+	strcpy(p, ") VALUES (");
+	p += strlen(p);
+
+	for(i = 0; i < ncols; i++) {
+		if(i) *p++ = ',';
+		*p++ = '?';
+	}
+
+	strcpy(p, ")");
+
+	return sql;
+}
+
+/*
+  Add up the rows of a batch that went in, and those that didn't,
+  from the statuses the driver filled in.
+*/
+static void count_loaded(const SQLUSMALLINT *status, SQLULEN processed,
+			 long *loaded, long *failed)
+{
+	SQLULEN i;
+
+	for(i = 0; i < processed; i++) {
+		switch(status[i]) {
+		case SQL_PARAM_SUCCESS:
+		case SQL_PARAM_SUCCESS_WITH_INFO:
+			(*loaded)++;
+			break;
+		case SQL_PARAM_ERROR:
+			(*failed)++;
+			break;
+		}
+	}
+}
+
+/*
+  How many rows from start to insert at once: up to LOAD_ROWS, as long
+  as the copies of their strings, each padded to the longest in its
+  column, fit in LOAD_BUFFER_SIZE.
+*/
+static long load_rows(arrow_reader *r, long start, long n)
+{
+	const arrow_column *c;
+	size_t *longest, width, len;
+	long rows;
+	int i, ncols;
+
+	ncols = arrow_reader_ncols(r);
+	if(!(longest = calloc(ncols, sizeof(size_t)))) err_system();
+
+	for(rows = 0; rows < LOAD_ROWS && start + rows < n; rows++) {
+		for(i = 0, width = 0; i < ncols; i++) {
+			c = arrow_reader_column(r, i);
+			if(c->type != ARROW_TYPE_UTF8 && c->type != ARROW_TYPE_BINARY) continue;
+
+			if(ARROW_IS_VALID(c, start + rows)) {
+				arrow_value(c, start + rows, &len);
+				if(len > longest[i]) longest[i] = len;
+			}
+			width += longest[i];
+		}
+
+		if(rows && (rows + 1) * width > LOAD_BUFFER_SIZE) break;
+	}
+
+	free(longest);
+
+	return rows;
+}
+
+static void *load_buffer(load_param *p, size_t n)
+{
+	if(n > p->cap) {
+		if(!(p->buf = realloc(p->buf, n))) err_system();
+		mem_add(MEM_BUFFERS, n - p->cap);
+		p->cap = n;
+	}
+
+	return p->buf;
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+	return a / b - (a % b < 0);
+}
+
+// the inverse of days_from_civil() in arrow.c
+static void civil_from_days(int64_t z, SQLSMALLINT *y, SQLUSMALLINT *m, SQLUSMALLINT *d)
+{
+	int64_t era, doe, yoe, doy, mp;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+  Bind rows start to start + rows - 1 of column c as parameter i.
+  Numbers are bound where they are; booleans, strings (which ODBC needs
+  at a fixed stride) and dates and times are converted into p->buf.
+*/
+static SQLRETURN bind_load_param(SQLHSTMT st, int i, const arrow_column *c,
+				 load_param *p, long start, long rows)
+{
+	static const int64_t per_second[] = { 1, 1000, 1000000, 1000000000 };
+	SQL_DATE_STRUCT *date;
+	SQL_TIMESTAMP_STRUCT *ts;
+	SQLSMALLINT ctype, sqltype, digits;
+	SQLULEN size;
+	SQLLEN stride;
+	SQLPOINTER data;
+	const unsigned char *v;
+	int64_t x, per, secs, frac, days;
+	int32_t x32;
+	size_t len;
+	long j;
+
+	for(j = 0; j < rows; j++)
+		p->ind[j] = ARROW_IS_VALID(c, start + j) ? c->width : SQL_NULL_DATA;
+
+	size = 0;
+	digits = 0;
+	stride = c->width;
+	data = (SQLPOINTER) (c->values + start * c->width);
+
+	switch(c->type) {
+	case ARROW_TYPE_INT:
+		switch(c->width) {
+		case 1:
+			ctype = c->is_signed ? SQL_C_STINYINT : SQL_C_UTINYINT;
+			sqltype = SQL_TINYINT;
+			break;
+		case 2:
+			ctype = c->is_signed ? SQL_C_SSHORT : SQL_C_USHORT;
+			sqltype = SQL_SMALLINT;
+			break;
+		case 4:
+			ctype = c->is_signed ? SQL_C_SLONG : SQL_C_ULONG;
+			sqltype = SQL_INTEGER;
+			break;
+		default:
+			ctype = c->is_signed ? SQL_C_SBIGINT : SQL_C_UBIGINT;
+			sqltype = SQL_BIGINT;
+		}
+		break;
+	case ARROW_TYPE_FLOAT:
+		ctype = c->width == 4 ? SQL_C_FLOAT : SQL_C_DOUBLE;
+		sqltype = c->width == 4 ? SQL_REAL : SQL_DOUBLE;
+		break;
+	case ARROW_TYPE_BOOL:
+		data = load_buffer(p, rows);
+		for(j = 0; j < rows; j++) p->buf[j] = ARROW_IS_BIT_SET(c, start + j);
+		ctype = SQL_C_BIT;
+		sqltype = SQL_BIT;
+		stride = 1;
+		break;
+	case ARROW_TYPE_UTF8:
+	case ARROW_TYPE_BINARY:
+		for(j = 0, stride = 1; j < rows; j++) {
+			if(p->ind[j] == SQL_NULL_DATA) continue;
+			arrow_value(c, start + j, &len);
+			if((SQLLEN) len > stride) stride = len;
+		}
+
+		data = load_buffer(p, rows * stride);
+		for(j = 0; j < rows; j++) {
+			if(p->ind[j] == SQL_NULL_DATA) continue;
+			v = arrow_value(c, start + j, &len);
+			memcpy(p->buf + j * stride, v, len);
+			p->ind[j] = len;
+		}
+
+		ctype = c->type == ARROW_TYPE_UTF8 ? SQL_C_CHAR : SQL_C_BINARY;
+		sqltype = c->type == ARROW_TYPE_UTF8 ? SQL_VARCHAR : SQL_VARBINARY;
+		size = stride;
+		break;
+	case ARROW_TYPE_DATE:
+		data = date = load_buffer(p, rows * sizeof(SQL_DATE_STRUCT));
+		for(j = 0; j < rows; j++) {
+			if(p->ind[j] == SQL_NULL_DATA) continue;
+
+			if(c->unit) {
+				memcpy(&x, c->values + (start + j) * 8, 8);
+				days = floor_div(x, 86400000);
+			} else {
+				memcpy(&x32, c->values + (start + j) * 4, 4);
+				days = x32;
+			}
+
+			civil_from_days(days, &date[j].year, &date[j].month, &date[j].day);
+		}
+
+		ctype = SQL_C_TYPE_DATE;
+		sqltype = SQL_TYPE_DATE;
+		size = 10;
+		stride = sizeof(SQL_DATE_STRUCT);
+		break;
+	default:  // ARROW_TYPE_TIMESTAMP
+		per = per_second[c->unit];
+		data = ts = load_buffer(p, rows * sizeof(SQL_TIMESTAMP_STRUCT));
+		for(j = 0; j < rows; j++) {
+			if(p->ind[j] == SQL_NULL_DATA) continue;
+
+			memcpy(&x, c->values + (start + j) * 8, 8);
+			secs = floor_div(x, per);
+			frac = x - secs * per;
+			days = floor_div(secs, 86400);
+			secs -= days * 86400;
+
+			civil_from_days(days, &ts[j].year, &ts[j].month, &ts[j].day);
+			ts[j].hour = secs / 3600;
+			ts[j].minute = secs / 60 % 60;
+			ts[j].second = secs % 60;
+			ts[j].fraction = frac * (1000000000 / per);
+		}
+
+		ctype = SQL_C_TYPE_TIMESTAMP;
+		sqltype = SQL_TYPE_TIMESTAMP;
+		digits = 3 * c->unit;
+		size = digits ? 20 + digits : 19;
+		stride = sizeof(SQL_TIMESTAMP_STRUCT);
+		break;
+	}
+
+	return SQLBindParameter(st, i + 1, SQL_PARAM_INPUT, ctype, sqltype,
+				size, digits, data, stride, p->ind);
+}
+
 results *get_tables(const char *catalog,
 		       const char *schema, const char *table)
 {
@@ -579,11 +1128,14 @@ results *get_tables(const char *catalog,
 	res_start_timer(res);
 
 	current_statement = st;
+	res_phase_start(res, RES_PHASE_FIRST_ROW);
+	res_phase_start(res, RES_PHASE_EXECUTE);
 	r = SQLTables(st,
 		      (SQLCHAR *) catalog, SQL_NTS,
 		      (SQLCHAR *) schema, SQL_NTS,
 		      (SQLCHAR *) table, SQL_NTS,
 		      (SQLCHAR *) 0, 0);
+	res_phase_stop(res, RES_PHASE_EXECUTE);
 
 	if(!SQL_SUCCEEDED(r)) {
 		report_error(SQL_HANDLE_STMT, st, r, _("Failed to list tables"));
@@ -618,11 +1170,14 @@ results *get_columns(const char *catalog,
 	res = res_alloc();
 	res_start_timer(res);
 
+	res_phase_start(res, RES_PHASE_FIRST_ROW);
+	res_phase_start(res, RES_PHASE_EXECUTE);
 	r = SQLColumns(st,
 		      (SQLCHAR *) catalog, SQL_NTS,
 		      (SQLCHAR *) schema, SQL_NTS,
 		      (SQLCHAR *) table, SQL_NTS,
 		      (SQLCHAR *) "%", SQL_NTS);
+	res_phase_stop(res, RES_PHASE_EXECUTE);
 
 	if(!SQL_SUCCEEDED(r)) {
 		report_error(SQL_HANDLE_STMT, st, r, _("Failed to list columns"));
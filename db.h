@@ -19,6 +19,7 @@
 #ifndef DB_H
 #define DB_H
 
+#include <stdio.h>
 #include <sys/time.h>
 
 #include <sql.h>
@@ -34,6 +35,7 @@ results *db_conn_details();
 int db_supports_catalogs();
 results *execute_query(const char *, int, parsed_line *);
 void db_cancel_query();
+results *db_load_arrow(const char *, FILE *);
 
 results *get_tables(const char *, const char *, const char *);
 results *get_columns(const char *, const char *, const char *);
@@ -0,0 +1,313 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Writing result sets into a SQLite database, for redirects to .sqlite
+  and .sqlite3 files and to .db files that are already databases.  Each
+  set becomes a table, declared from the column names and types, and
+  its rows are inserted as they're fetched with one prepared statement,
+  reset and rebound for each row, all in a single transaction so that
+  SQLite only syncs once.  Values are bound as text and left to the
+  columns' affinities to store as numbers.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SQLITE3_H) && defined(HAVE_LIBSQLITE3)
+#define EXPORT_SQLITE 1
+#include <sqlite3.h>
+#endif
+
+#include "common.h"
+#include "err.h"
+#include "export.h"
+#include "results.h"
+
+#define EXPORT_RELEASE_ROWS 1024
+
+
+#ifdef EXPORT_SQLITE
+static int is_database(const char *, int);
+static char *get_col(results *, int);
+static int exec(sqlite3 *, char *);
+static int create_table(sqlite3 *, results *, const char *, int);
+static char *insert_statement(results *, const char *);
+static long export_set(sqlite3 *, results *, const char *, int);
+#endif
+
+
+/*
+  Whether a file name is that of a SQLite database that output should
+  go into as a table (rather than as text).  .sqlite and .sqlite3 files
+  are if they're new or already databases; .db is used for too many
+  other things, so only existing databases are.
+*/
+int export_sqlite_target(const char *name)
+{
+#ifdef EXPORT_SQLITE
+	static const struct {
+		const char *ext;
+		int create;
+	} exts[] = {
+		{ ".sqlite", 1 },
+		{ ".sqlite3", 1 },
+		{ ".db", 0 },
+		{ 0, 0 }
+	};
+	size_t l, e;
+	int i;
+
+	l = strlen(name);
+	for(i = 0; exts[i].ext; i++) {
+		e = strlen(exts[i].ext);
+		if(l > e && !strcmp(name + l - e, exts[i].ext))
+			return is_database(name, exts[i].create);
+	}
+#endif
+
+	return 0;
+}
+
+#ifdef EXPORT_SQLITE
+
+/*
+  Whether file is a SQLite 3 database, going by its header.  A file
+  that doesn't exist yet, or is empty, counts if create is set.
+*/
+static int is_database(const char *file, int create)
+{
+	static const char magic[16] = "SQLite format 3";
+	char header[16];
+	ssize_t n;
+	int fd;
+
+	if((fd = open(file, O_RDONLY)) == -1) return create && errno == ENOENT;
+
+	n = read(fd, header, sizeof(header));
+	close(fd);
+
+	if(!n) return create;
+	return n == sizeof(header) && !memcmp(header, magic, sizeof(header));
+}
+
+/*
+  Write each result set into a table in the database in file: the
+  first to table, any more to table_2, table_3 and so on.  Tables of
+  those names are replaced, unless appending.
+*/
+void export_sqlite(results *res, const char *file, const char *table, int append)
+{
+	struct timespec start, end;
+	sqlite3 *db;
+	char *name;
+	wchar_t *w;
+	long rows;
+	double t;
+	int n;
+
+	if(sqlite3_open_v2(file, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0) != SQLITE_OK) {
+		printf(_("Failed to open %s: %s\n"), file, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return;
+	}
+
+	res_first_set(res);
+
+	n = 0;
+	do {
+		if(res_get_nrows(res) == -1 || !res_get_ncols(res)) continue;
+
+		if(clock_gettime(CLOCK_MONOTONIC, &start)) err_system();
+
+		if(n++) name = sqlite3_mprintf("%s_%d", table, n);
+		else name = sqlite3_mprintf("%s", table);
+		if(!name) err_system();
+
+		rows = export_set(db, res, name, append);
+
+		if(clock_gettime(CLOCK_MONOTONIC, &end)) err_system();
+		t = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		if(rows >= 0)
+			printf(ngettext("%ld row written to table %s in %s in %.3fs (%.0f rows/s)\n",
+					"%ld rows written to table %s in %s in %.3fs (%.0f rows/s)\n",
+					rows),
+			       rows, name, file, t, t > 0 ? rows / t : 0.0);
+
+		sqlite3_free(name);
+		if(rows < 0) break;
+	} while(res_next_set(res));
+
+	while((w = res_next_warning(res))) printf("%ls\n", w);
+
+	sqlite3_close(db);
+}
+
+
+static char *get_col(results *res, int i)
+{
+	char *col;
+	size_t l;
+
+	if((l = wcstombs(0, res_get_col(res, i), 0)) == (size_t) -1) err_system();
+	if(!(col = malloc(l + 1))) err_system();
+	wcstombs(col, res_get_col(res, i), l + 1);
+
+	return col;
+}
+
+// runs and frees sql, which is from sqlite3_mprintf()
+static int exec(sqlite3 *db, char *sql)
+{
+	int r;
+
+	if(!sql) err_system();
+
+	r = sqlite3_exec(db, sql, 0, 0, 0);
+	sqlite3_free(sql);
+
+	if(r != SQLITE_OK) printf(_("SQLite error: %s\n"), sqlite3_errmsg(db));
+	return r == SQLITE_OK;
+}
+
+static int create_table(sqlite3 *db, results *res, const char *table, int append)
+{
+	const char *type;
+	char *sql, *col;
+	int i, ncols;
+
+	if(!append && !exec(db, sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\"", table)))
+		return 0;
+
+	ncols = res_get_ncols(res);
+	sql = sqlite3_mprintf("CREATE TABLE %s\"%w\" (", append ? "IF NOT EXISTS " : "", table);
+
+	for(i = 0; i < ncols && sql; i++) {
+		switch(res_get_col_type(res, i)) {
+		case RES_TYPE_INTEGER: type = "INTEGER"; break;
+		case RES_TYPE_FLOAT:   type = "REAL";    break;
+		case RES_TYPE_DECIMAL: type = "NUMERIC"; break;
+		default:               type = "TEXT";    break;
+		}
+
+		col = get_col(res, i);
+		sql = sqlite3_mprintf("%z%s\"%w\" %s", sql, i ? ", " : "", col, type);
+		free(col);
+	}
+
+	return exec(db, sqlite3_mprintf("%z)", sql));
+}
+
+static char *insert_statement(results *res, const char *table)
+{
+	char *sql, *col;
+	int i, ncols;
+
+	ncols = res_get_ncols(res);
+	sql = sqlite3_mprintf("INSERT INTO \"%w\" (", table);
+
+	for(i = 0; i < ncols && sql; i++) {
+		col = get_col(res, i);
+		sql = sqlite3_mprintf("%z%s\"%w\"", sql, i ? ", " : "", col);
+		free(col);
+	}
+
+	sql = sqlite3_mprintf("%z) VALUES (", sql);
+	for(i = 0; i < ncols && sql; i++) sql = sqlite3_mprintf("%z%s?", sql, i ? ", " : "");
+	sql = sqlite3_mprintf("%z)", sql);
+
+	if(!sql) err_system();
+	return sql;
+}
+
+/*
+  Create table for the current result set and insert its rows,
+  letting go of them as it goes.  Returns the number of rows, or -1 if
+  it failed (in which case none were written).
+*/
+static long export_set(sqlite3 *db, results *res, const char *table, int append)
+{
+	sqlite3_stmt *st;
+	char *sql, **data;
+	long rows;
+	int i, ncols, r;
+
+	if(!exec(db, sqlite3_mprintf("BEGIN"))) return -1;
+
+	if(!create_table(db, res, table, append)) {
+		exec(db, sqlite3_mprintf("ROLLBACK"));
+		return -1;
+	}
+
+	sql = insert_statement(res, table);
+	r = sqlite3_prepare_v2(db, sql, -1, &st, 0);
+	sqlite3_free(sql);
+
+	if(r != SQLITE_OK) {
+		printf(_("SQLite error: %s\n"), sqlite3_errmsg(db));
+		exec(db, sqlite3_mprintf("ROLLBACK"));
+		return -1;
+	}
+
+	ncols = res_get_ncols(res);
+
+	rows = 0;
+	while(res_next_row(res)) {
+		data = res_get_mb_row(res);
+
+		// the values outlive the step, which is all SQLITE_STATIC needs
+		for(i = 0; i < ncols; i++)
+			if(data[i]) sqlite3_bind_text(st, i + 1, data[i], -1, SQLITE_STATIC);
+			else sqlite3_bind_null(st, i + 1);
+
+		if(sqlite3_step(st) != SQLITE_DONE) {
+			printf(_("SQLite error: %s\n"), sqlite3_errmsg(db));
+			rows = -1;
+			break;
+		}
+		sqlite3_reset(st);
+
+		if(++rows % EXPORT_RELEASE_ROWS == 0) res_discard_rows(res);
+	}
+
+	sqlite3_finalize(st);
+
+	if(rows < 0 || !exec(db, sqlite3_mprintf("COMMIT"))) {
+		exec(db, sqlite3_mprintf("ROLLBACK"));
+		return -1;
+	}
+
+	return rows;
+}
+
+#else
+
+void export_sqlite(results *res, const char *file, const char *table, int append)
+{
+	// export_sqlite_target() never says yes
+}
+
+#endif
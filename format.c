@@ -0,0 +1,266 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+  Parallel formatting for the output modes where most of the work is
+  turning values into text.  The calling thread copies rows into
+  blocks as they're fetched; a pool of threads formats whole blocks,
+  each into a buffer stream of its own; and the calling thread writes
+  the finished text out, in order.  The threads and the ring of blocks
+  are run by pool.c, as for compress.c.
+
+  Because the values are copied, the workers never touch the results,
+  and the results can drop rows as soon as they're in a block.  The
+  functions that do the formatting must only write to the stream they
+  are given and read what's passed to them.
+
+  Nothing is started until a second block is needed: rows that fit in
+  one are formatted on the calling thread, straight to the output.
+*/
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "err.h"
+#include "format.h"
+#include "mem.h"
+#include "pool.h"
+#include "stream.h"
+#include "text.h"
+
+#define FORMAT_BLOCK_ROWS 1024
+#define FORMAT_BLOCK_BYTES (1024 * 1024)
+#define FORMAT_NULL ((size_t) -1)
+
+
+typedef struct {
+	long first;
+	int nrows;
+	char *data;         // the values, one after another
+	size_t len;
+	size_t cap;
+	size_t *offsets;    // of each value in data, or FORMAT_NULL
+	size_t offsets_cap;
+	char **rows;        // the values again, as format_fn wants them
+	size_t rows_cap;
+	stream *out;
+} block;
+
+struct formatter {
+	stream *s;
+	int ncols;
+	format_fn fn;
+	void *arg;
+	long nrows;
+	int nthreads;
+	block_pool *pool;  // once there's more than one block
+	block *blocks;
+	int nblocks;
+	int current;  // the block being filled
+};
+
+
+static void submit(formatter *);
+static void work(void *, int);
+static void write_out(void *, int);
+static void format_block(formatter *, block *, stream *);
+static void *reserve(void *, size_t *, size_t, size_t);
+
+
+/*
+  How many threads to format with: DBSH_FORMAT_THREADS, or the number
+  of processors.  With one there's no point in a formatter at all.
+*/
+int format_threads(void)
+{
+	return pool_threads("DBSH_FORMAT_THREADS");
+}
+
+formatter *format_create(stream *s, int ncols, format_fn fn, void *arg)
+{
+	formatter *f;
+
+	if(!(f = calloc(1, sizeof(formatter)))) err_system();
+
+	f->s = s;
+	f->ncols = ncols;
+	f->fn = fn;
+	f->arg = arg;
+	f->nthreads = format_threads();
+	f->nblocks = f->nthreads * 2;
+
+	if(!(f->blocks = calloc(f->nblocks, sizeof(block)))) err_system();
+
+	return f;
+}
+
+/*
+  Add a row to the current block, handing the block to the workers
+  first if it's full.
+*/
+void format_row(formatter *f, char **row)
+{
+	block *b;
+	size_t l;
+	int i;
+
+	b = &f->blocks[f->current];
+	if(b->nrows == FORMAT_BLOCK_ROWS || b->len >= FORMAT_BLOCK_BYTES) {
+		submit(f);
+		b = &f->blocks[f->current];
+	}
+
+	if(!b->nrows) b->first = f->nrows;
+
+	b->offsets = reserve(b->offsets, &b->offsets_cap,
+			     (b->nrows + 1) * f->ncols, sizeof(size_t));
+
+	for(i = 0; i < f->ncols; i++) {
+		if(!row[i]) {
+			b->offsets[b->nrows * f->ncols + i] = FORMAT_NULL;
+			continue;
+		}
+
+		l = strlen(row[i]) + 1;
+		b->data = reserve(b->data, &b->cap, b->len + l, 1);
+		memcpy(b->data + b->len, row[i], l);
+		b->offsets[b->nrows * f->ncols + i] = b->len;
+		b->len += l;
+	}
+
+	b->nrows++;
+	f->nrows++;
+}
+
+/*
+  Format and write whatever's left, stop the workers and free
+  everything.
+*/
+void format_finish(formatter *f)
+{
+	block *b;
+	int i;
+
+	b = &f->blocks[f->current];
+
+	if(!f->pool) {
+		if(b->nrows) format_block(f, b, f->s);
+	} else {
+		if(b->nrows) pool_submit(f->pool);
+		pool_finish(f->pool);
+	}
+
+	for(i = 0; i < f->nblocks; i++) {
+		b = &f->blocks[i];
+		mem_sub(MEM_BUFFERS, b->cap + b->offsets_cap * sizeof(size_t) +
+			b->rows_cap * sizeof(char *));
+		free(b->data);
+		free(b->offsets);
+		free(b->rows);
+		if(b->out) stream_free(b->out);
+	}
+	free(f->blocks);
+	free(f);
+}
+
+
+/*
+  Hand the current block to the workers and move on to the next,
+  starting them first if this is the first block to go.  Make sure
+  that what they share is ready for them before that.
+*/
+static void submit(formatter *f)
+{
+	int i;
+
+	if(!f->pool) {
+		text_init_threads();
+		for(i = 0; i < f->nblocks; i++) f->blocks[i].out = stream_create_buffer();
+		f->pool = pool_create(f->nthreads, f->nblocks, work, write_out, f);
+	}
+
+	f->current = pool_submit(f->pool);
+}
+
+static void work(void *arg, int i)
+{
+	formatter *f;
+
+	f = arg;
+	format_block(f, &f->blocks[i], f->blocks[i].out);
+}
+
+/*
+  Write out block i, now that it's been formatted, and empty it.
+*/
+static void write_out(void *arg, int i)
+{
+	formatter *f;
+	block *b;
+	const char *data;
+	size_t len;
+
+	f = arg;
+	b = &f->blocks[i];
+
+	data = stream_contents(b->out, &len);
+	stream_write(f->s, data, len);
+
+	b->nrows = 0;
+	b->len = 0;
+}
+
+/*
+  Runs in a worker unless the formatter never started any, so it
+  mustn't touch anything but b and out.
+*/
+static void format_block(formatter *f, block *b, stream *out)
+{
+	size_t i, n;
+
+	n = (size_t) b->nrows * f->ncols;
+	b->rows = reserve(b->rows, &b->rows_cap, n, sizeof(char *));
+
+	for(i = 0; i < n; i++)
+		b->rows[i] = b->offsets[i] == FORMAT_NULL ? 0 : b->data + b->offsets[i];
+
+	f->fn(out, b->rows, b->nrows, f->ncols, b->first, f->arg);
+	stream_flush(out);
+}
+
+/*
+  Grow p, an array of *cap elements of the given size, to hold at
+  least n of them.
+*/
+static void *reserve(void *p, size_t *cap, size_t n, size_t size)
+{
+	size_t c;
+
+	if(n <= *cap) return p;
+
+	for(c = *cap ? *cap : 64; c < n; c *= 2);
+	if(!(p = realloc(p, c * size))) err_system();
+	mem_add(MEM_BUFFERS, (c - *cap) * size);
+	*cap = c;
+
+	return p;
+}
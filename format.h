@@ -0,0 +1,36 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+/*
+  Formats nrows rows of ncols values each, row j's values starting at
+  rows[j * ncols] (and NULL for NULL).  first is the number of the
+  first of them in the result set.
+*/
+typedef void (*format_fn)(stream *, char **rows, int nrows, int ncols,
+			  long first, void *arg);
+
+int format_threads(void);
+formatter *format_create(stream *, int, format_fn, void *);
+void format_row(formatter *, char **);
+void format_finish(formatter *);
+
+#endif
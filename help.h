@@ -36,7 +36,10 @@
 "Other commands:\n" \
 "  set [<variable>] [<value>]\n" \
 "  unset <variable>\n" \
-"  info" \
+"  info\n" \
+"  mem\n" \
+"  timing [on|off]\n" \
+"  load <table> <file>" \
 		)
 
 #define HELP_NOTFOUND _("Help topic doesn't exist")
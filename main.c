@@ -33,6 +33,7 @@
 #include "parser.h"
 #include "prompt.h"
 #include "rc.h"
+#include "results.h"
 #include "rl.h"
 #include "sig.h"
 #include "stream.h"
@@ -45,7 +46,7 @@ buffer *mainbuf, *prevbuf;
 
 void usage(const char *cmd)
 {
-	printf(_("Usage: %s -l\n       %s <dsn> [<username>] [<password>]\n"),
+	printf(_("Usage: %s -l\n       %s [-i <table>] <dsn> [<username>] [<password>]\n"),
 	       cmd, cmd);
 }
 
@@ -108,8 +109,9 @@ int process_line(char *line)
 int main(int argc, char *argv[])
 {
 	int opt;
-	char *line, *p;
+	char *line, *p, *load_table;
 	results *r;
+	stream *s;
 
 	setlocale(LC_ALL, "");
 
@@ -118,11 +120,18 @@ int main(int argc, char *argv[])
 
 	read_rc_file();
 
-	while((opt = getopt(argc, argv, "lv")) != -1) {
+	load_table = 0;
+
+	while((opt = getopt(argc, argv, "i:lv")) != -1) {
 		switch(opt) {
+		case 'i':
+			load_table = optarg;
+			break;
 		case 'l':
 			r = db_drivers_and_dsns();
-			output_results(r, 1, stream_create(stdout));
+			s = stream_create(stdout);
+			output_results(r, 1, s);
+			stream_free(s);
 			return 0;
 			break;
 		case 'v':
@@ -137,14 +146,15 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	puts(PACKAGE_STRING " Copyright (C) 2007, 2008 Ben Spencer\n"
-	     "This program comes with ABSOLUTELY NO WARRANTY; "
-	     "for details type `/warranty; | more'\n"
-	     "This is free software: "
-	     "you are welcome to modify and redistribute it\n"
-	     "under certain conditions; for details type "
-	     "`/copying; | more'\n"
-	     "Type `/help' for help or `\\q' to quit.\n");
+	if(!load_table)
+		puts(PACKAGE_STRING " Copyright (C) 2007, 2008 Ben Spencer\n"
+		     "This program comes with ABSOLUTELY NO WARRANTY; "
+		     "for details type `/warranty; | more'\n"
+		     "This is free software: "
+		     "you are welcome to modify and redistribute it\n"
+		     "under certain conditions; for details type "
+		     "`/copying; | more'\n"
+		     "Type `/help' for help or `\\q' to quit.\n");
 
 	dsn = argv[optind++];
 	if(argc - optind > 0) user = argv[optind++];
@@ -155,6 +165,19 @@ int main(int argc, char *argv[])
 
 	if(!db_connect()) exit(1);
 
+	// an Arrow stream on stdin, say from another dbsh's \A output
+	if(load_table) {
+		if((r = db_load_arrow(load_table, stdin))) {
+			s = stream_create(stdout);
+			output_results(r, 1, s);
+			stream_free(s);
+			res_free(r);
+		}
+
+		db_close();
+		return r ? 0 : 1;
+	}
+
 	rl_history_start();
 	signal_handlers_install();
 
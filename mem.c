@@ -0,0 +1,136 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Session-wide memory accounting.  The counters only cover the big
+  consumers (result storage, I/O buffers and caches) and count
+  requested sizes rather than allocator overhead, so treat them as a
+  lower bound.  MEM_SPILLED counts result data moved out to disk.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "mem.h"
+
+
+static size_t usage[MEM_NCATEGORIES];
+
+
+void mem_add(mem_category c, ssize_t bytes)
+{
+	__sync_fetch_and_add(&usage[c], bytes);
+}
+
+void mem_sub(mem_category c, ssize_t bytes)
+{
+	__sync_fetch_and_sub(&usage[c], bytes);
+}
+
+size_t mem_usage(mem_category c)
+{
+	return __sync_fetch_and_add(&usage[c], 0);
+}
+
+/*
+  Parse a size in bytes with an optional k/M/G suffix into *size.
+  Returns 0, leaving *size alone, if v isn't one or is too big.
+*/
+int mem_parse_size(const char *v, size_t *size)
+{
+	char *end;
+	unsigned long long l;
+	int shift;
+
+	while(isspace((unsigned char) *v)) v++;
+	if(!isdigit((unsigned char) *v)) return 0;
+
+	errno = 0;
+	l = strtoull(v, &end, 10);
+	if(errno) return 0;
+
+	shift = 0;
+	switch(*end) {
+	case 'g':
+	case 'G':
+		shift += 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		shift += 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		shift += 10;
+		end++;
+	}
+
+	if(*end || l > (SIZE_MAX >> shift)) return 0;
+
+	*size = (size_t) l << shift;
+	return 1;
+}
+
+/*
+  The size in environment variable var, or 0 if it's unset or not a
+  size (which is then reported, under the name of its option).
+*/
+static size_t size_option(const char *var, const char *option)
+{
+	const char *v;
+	size_t size;
+
+	if(!(v = getenv(var))) return 0;
+
+	if(!mem_parse_size(v, &size)) {
+		fprintf(stderr, _("Ignoring %s: '%s' is not a size\n"), option, v);
+		return 0;
+	}
+
+	return size;
+}
+
+/*
+  DBSH_MAX_RESULT_MEMORY - returns 0 if no limit is set.
+*/
+size_t mem_limit()
+{
+	return size_option("DBSH_MAX_RESULT_MEMORY", "max_result_memory");
+}
+
+/*
+  DBSH_SPILL_THRESHOLD - returns 0 if result sets should never spill.
+*/
+size_t mem_spill_threshold()
+{
+	return size_option("DBSH_SPILL_THRESHOLD", "spill_threshold");
+}
+
+void mem_format(char *buf, size_t len, size_t bytes)
+{
+	if(bytes >= 10 * 1024 * 1024)
+		snprintf(buf, len, "%luM", (unsigned long) (bytes >> 20));
+	else if(bytes >= 10 * 1024)
+		snprintf(buf, len, "%luk", (unsigned long) (bytes >> 10));
+	else
+		snprintf(buf, len, "%lu", (unsigned long) bytes);
+}
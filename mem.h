@@ -0,0 +1,39 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MEM_H
+#define MEM_H
+
+#include <sys/types.h>
+
+typedef enum {
+	MEM_RESULTS,
+	MEM_BUFFERS,
+	MEM_CACHES,
+	MEM_SPILLED,
+	MEM_NCATEGORIES
+} mem_category;
+
+void mem_add(mem_category, ssize_t);
+void mem_sub(mem_category, ssize_t);
+size_t mem_usage(mem_category);
+int mem_parse_size(const char *, size_t *);
+size_t mem_limit();
+size_t mem_spill_threshold();
+void mem_format(char *, size_t, size_t);
+
+#endif
@@ -18,6 +18,7 @@
 
 #include <config.h>
 
+#include <langinfo.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,167 +26,234 @@
 
 #include "cntrl.h"
 #include "common.h"
+#include "arrow.h"
 #include "err.h"
+#include "format.h"
 #include "output.h"
+#include "pager.h"
 #include "results.h"
 #include "stream.h"
+#include "text.h"
 
 
+/*
+  A cell's translated text, with the display width of each of its
+  lines.  Cells are reused from row to row, so once their buffers have
+  grown to fit the data there's no allocation per value.
+*/
 typedef struct {
+	wchar_t *text;
+	size_t len;
+	size_t cap;
 	int lines;
 	int *widths;
+	int widths_cap;
 	int max_width;
+	const wchar_t *pos;
 } dim;
 
-typedef struct {
-	dim **col_dims;
-	dim **row_dims;
-} res_dims;
-
 typedef enum {
-	VPOS_TOP,
-	VPOS_MID,
-	VPOS_BOT
-} vpos;
+	CSV_QUOTE_ALWAYS,
+	CSV_QUOTE_MINIMAL,
+	CSV_QUOTE_NEVER
+} csv_quote;
 
-typedef enum {
-	HPOS_LEF,
-	HPOS_MID,
-	HPOS_RIG
-} hpos;
+/*
+  A run of text that can be written with some or all of its leading
+  spaces, so padding and the border after it go out in one write.
+*/
+typedef struct {
+	char *text;
+	size_t len;
+	int spaces;
+} piece;
+
+/*
+  Everything needed to draw a table's borders, worked out once per
+  result set: the localised glyphs, the separator lines for the
+  current column widths, and the padded column borders.
+*/
+typedef struct {
+	glyphs g;
+	int *widths;
+	int ncols;
+	piece lines[3];
+	piece gap;
+	piece end;
+} render_plan;
 
 #define NULL_DISPLAY L"*NULL*"
+#define TRUNCATED_MARKER L'>'
+#define STREAM_SAMPLE_ROWS 100
+#define RELEASE_ROWS 1024
 
 
 
-static wchar_t *translate(wchar_t *src)
+static dim *dims_alloc(int n)
 {
-	wchar_t *dest, *p, *q, *r;
-	int l;
+	dim *d;
+
+	if(!(d = calloc(n, sizeof(dim)))) err_system();
+	return d;
+}
 
-	if(!src) {
-		l = wcslen(cntrl[0]);
-		if(!(dest = calloc(l + 1, sizeof(wchar_t)))) err_system();
-		for(r = cntrl[0], q = dest; *r; r++) *q++ = *r;
+static void dims_free(dim *d, int n)
+{
+	int i;
 
-		return dest;
+	for(i = 0; i < n; i++) {
+		free(d[i].text);
+		free(d[i].widths);
 	}
+	free(d);
+}
 
-	l = 0;
-	for(p = src; *p; p++) {
-		if(*p < 32) l += wcslen(cntrl[*p]);
-	        else if(*p == 127) l += wcslen(cntrl[32]);
-		else l++;
-	}
+static int char_width(wchar_t c)
+{
+	int w;
 
-	if(!(dest = calloc(l + 1, sizeof(wchar_t)))) err_system();
+	if(c == L'\t') return 8;
+	w = text_wcwidth(c);
+	return w > 0 ? w : 0;
+}
 
-	for(p = src, q = dest; *p; p++) {
-		if(*p != L'\r' || p[1] != L'\n') {
-			if(*p < 32 || *p == 127) {
-				for(r = (*p == 127) ? cntrl[32] : cntrl[*p];
-				    *r; r++)
-					*q++ = *r;
-			} else *q++ = *p;
-		}
-	}
+static void dim_reserve(dim *d, size_t n)
+{
+	if(d->len + n < d->cap) return;
 
-	return dest;
+	d->cap = d->cap ? d->cap * 2 : 64;
+	while(d->cap <= d->len + n) d->cap *= 2;
+	if(!(d->text = realloc(d->text, d->cap * sizeof(wchar_t)))) err_system();
 }
 
-static void translate_resultset(results *res)
+static void dim_putc(dim *d, wchar_t c)
 {
-	int i;
-	wchar_t *t;
+	dim_reserve(d, 1);
 
-	while(res_next_row(res)) {
-		for(i = 0; i < res_get_ncols(res); i++) {
-			t = translate(res_get_value(res, i));
-			res_set_value_w(res, i, t);
-			free(t);
+	if(c == L'\n') {
+		if(d->lines == d->widths_cap) {
+			d->widths_cap *= 2;
+			if(!(d->widths = realloc(d->widths, d->widths_cap * sizeof(int))))
+				err_system();
 		}
-	};
+		d->widths[d->lines++] = 0;
+	} else {
+		d->widths[d->lines - 1] += char_width(c);
+	}
+
+	d->text[d->len++] = c;
 }
 
-static dim *get_dimensions(const wchar_t *s)
+/*
+  Fill in d from src in a single pass, translating control characters
+  (and NULL) for display if asked, and measuring each line as it goes.
+*/
+static void measure(dim *d, const wchar_t *src, int translate)
 {
-	dim *d;
-	const wchar_t *p;
-	int line, w;
+	const wchar_t *p, *r;
+	size_t n;
+	int i;
 
-	if(!(d = calloc(1, sizeof(dim)))) err_system();
+	if(!d->widths_cap) {
+		d->widths_cap = 4;
+		if(!(d->widths = malloc(d->widths_cap * sizeof(int)))) err_system();
+	}
 
+	d->len = 0;
 	d->lines = 1;
-	for(p = s; *p; p++)  if(*p == L'\n') d->lines++;
-
-	if(!(d->widths = calloc(d->lines, sizeof(int)))) err_system();
-
-	line = 0;
-	for(p = s; *p; p++) {
-		if(*p == L'\n') {
-			if(d->widths[line] > d->max_width)
-				d->max_width = d->widths[line];
-			line++;
-		} else if(*p == L'\t') {
-			d->widths[line] += 8;
-		} else {
-			w = wcwidth(*p);
-			if(w > 0) d->widths[line] += w;
-		}
+	d->widths[0] = 0;
+
+	if(!src) src = translate ? cntrl[0] : L"";
+
+	for(p = src; *p; p++) {
+		// printable ASCII needs no translation and is one column each
+		if((n = text_ascii_run(p))) {
+			dim_reserve(d, n);
+			wmemcpy(d->text + d->len, p, n);
+			d->len += n;
+			d->widths[d->lines - 1] += n;
+			p += n - 1;
+		} else if(translate && (*p < 32 || *p == 127)) {
+			if(*p == L'\r' && p[1] == L'\n') continue;
+			for(r = (*p == 127) ? cntrl[32] : cntrl[*p]; *r; r++)
+				dim_putc(d, *r);
+		} else dim_putc(d, *p);
 	}
 
-	if(d->widths[line] > d->max_width) d->max_width = d->widths[line];
+	dim_reserve(d, 0);
+	d->text[d->len] = 0;
 
-	return d;
+	d->max_width = 0;
+	for(i = 0; i < d->lines; i++)
+		if(d->widths[i] > d->max_width) d->max_width = d->widths[i];
 }
 
-static void free_dimensions(dim *d)
+static void measure_headings(results *res, dim *head)
 {
-	free(d->widths);
-	free(d);
+	int i;
+
+	for(i = 0; i < res_get_ncols(res); i++)
+		measure(&head[i], res_get_col(res, i), 0);
 }
 
-static res_dims *get_resultset_dimensions(results *res)
+static void measure_row(results *res, dim *cells)
 {
-	res_dims *rd;
-	int ncols, i, j;
-
-	ncols = res_get_ncols(res);
-
-	if(!(rd = malloc(sizeof(res_dims)))) err_system();
-	if(!(rd->col_dims = calloc(ncols, sizeof(dim)))) err_system();
-	if(!(rd->row_dims = calloc(ncols * res_get_nrows(res), sizeof(dim)))) err_system();
-
-	for(i = 0; i < res_get_ncols(res); i++) {
-		rd->col_dims[i] = get_dimensions(res_get_col(res, i));
-
-		j = 0;
-		while(res_next_row(res)) {
-			rd->row_dims[(j * ncols) + i] =
-				get_dimensions(res_get_value(res, i));
-			j++;
-		};
-	}
+	int i;
 
-	return rd;
+	for(i = 0; i < res_get_ncols(res); i++)
+		measure(&cells[i], res_get_value(res, i), 1);
 }
 
-static void free_resultset_dimensions(results *res, res_dims *rd)
+/*
+  Work out the widest line in each column (including its heading).
+  Cells are measured again as each row is printed rather than kept for
+  the whole result set, so that this doesn't cost memory in proportion
+  to the number of cells.  Columnar sets are measured a column at a
+  time, straight from their buffers.
+*/
+static int *get_column_widths(results *res, dim *head)
 {
 	int ncols, i, j;
+	int *widths;
+	dim d;
+	res_column c;
+	wchar_t *buf;
+	size_t cap;
+	const char *v;
 
 	ncols = res_get_ncols(res);
 
-	for(i = 0; i < ncols; i++) {
-		free_dimensions(rd->col_dims[i]);
-		for(j = 0; j < res_get_nrows(res); j++) {
-			free_dimensions(rd->row_dims[(j * ncols) + i]);
+	if(!(widths = calloc(ncols, sizeof(int)))) err_system();
+
+	for(i = 0; i < ncols; i++) widths[i] = head[i].max_width;
+
+	memset(&d, 0, sizeof(d));
+	buf = 0;
+	cap = 0;
+
+	if(ncols && res_get_column(res, 0, &c)) {
+		for(i = 0; i < ncols; i++) {
+			res_get_column(res, i, &c);
+			for(j = 0; j < c.nrows; j++) {
+				v = RES_COLUMN_VALUE(&c, j);
+				measure(&d, v ? text_widen(&buf, &cap, v) : 0, 1);
+				if(d.max_width > widths[i]) widths[i] = d.max_width;
+			}
+		}
+	} else {
+		while(res_next_row(res)) {
+			for(i = 0; i < ncols; i++) {
+				measure(&d, res_get_value(res, i), 1);
+				if(d.max_width > widths[i]) widths[i] = d.max_width;
+			}
 		}
 	}
 
-	free(rd->col_dims);
-	free(rd->row_dims);
-	free(rd);
+	free(buf);
+	free(d.text);
+	free(d.widths);
+
+	return widths;
 }
 
 static const char *get_box_char(vpos v, hpos h)
@@ -225,308 +293,1347 @@ static const char *get_box_char(vpos v, hpos h)
 	return "+";
 }
 
-static void output_size(results *res, stream *s)
+/*
+  The glyphs tables are drawn with, as localised.
+*/
+void output_glyphs(glyphs *g)
 {
-	int nrows;
+	vpos v;
+	hpos h;
 
-	nrows = res_get_nrows(res);
-	stream_printf(s,
-		      ngettext("1 row in set\n", "%d rows in set\n", nrows),
-		      nrows);
+	for(v = VPOS_TOP; v <= VPOS_BOT; v++)
+		for(h = HPOS_LEF; h <= HPOS_RIG; h++)
+			g->box[v][h] = get_box_char(v, h);
+
+	g->bar = _("|");
+	g->dash = _("-");
 }
 
-void output_horiz_separator(stream *s, int col_widths[], int ncols, vpos v)
+static void piece_set(piece *p, int spaces, const char *a, const char *b)
 {
-	hpos h;
-	int i, j;
+	size_t la, lb;
+	char *t;
 
-	h = HPOS_LEF;
+	la = strlen(a);
+	lb = strlen(b);
 
-	for(i = 0; i < ncols; i++) {
-		stream_puts(s, get_box_char(v, h));
-		for(j = 0; j < col_widths[i] + 2; j++) stream_puts(s,  _("-"));
-		h = HPOS_MID;
-	}
-	stream_puts(s, get_box_char(v, HPOS_RIG));
-	stream_newline(s);
+	if(!(t = malloc(spaces + la + lb + 1))) err_system();
+	memset(t, ' ', spaces);
+	memcpy(t + spaces, a, la);
+	memcpy(t + spaces + la, b, lb + 1);
+
+	free(p->text);
+	p->text = t;
+	p->len = spaces + la + lb;
+	p->spaces = spaces;
 }
 
-void output_horiz_row(stream *s, wchar_t **data,
-		      dim **dims, int widths[], int ncols)
+/*
+  Make room for p to be written with up to n spaces before it.
+*/
+static void piece_reserve(piece *p, int n)
 {
-	const wchar_t **pos, *p;
-	int i, j, k, more_lines;
+	char *suffix;
 
-	pos = calloc(ncols, sizeof(wchar_t *));
-	memcpy(pos, data, ncols * sizeof(wchar_t *));
+	if(n <= p->spaces) return;
 
-	for(i = 0; i < ncols; i++) if(!pos[i]) pos[i] = NULL_DISPLAY;
+	if(!(suffix = strdup(p->text + p->spaces))) err_system();
+	piece_set(p, n * 2, suffix, "");
+	free(suffix);
+}
 
-	j = 0;
-	do {
-		more_lines = 0;
+/*
+  Write p preceded by n spaces.
+*/
+static void put_piece(stream *s, piece *p, int n)
+{
+	if(n < 0) n = 0;
 
-		for(i = 0; i < ncols; i++) {
+	piece_reserve(p, n);
+	stream_write(s, p->text + p->spaces - n, p->len - p->spaces + n);
+}
 
-			stream_puts(s, _("|"));
-			stream_space(s);
-
-			for(p = pos[i]; *p; p++) {
-				if(*p == L'\n') {
-					pos[i] = p + 1;
-					more_lines = 1;
-					break;
-				} else if(*p == L'\t') {
-					stream_putws(s, L"        ");
-				} else {
-					stream_putwc(s, *p);
-				}
-			}
+static char *append(char *q, const char *s)
+{
+	size_t l;
 
-			if(!*p) pos[i] = p;
+	l = strlen(s);
+	memcpy(q, s, l + 1);
+	return q + l;
+}
 
-			for(k = j < dims[i]->lines ? dims[i]->widths[j] : 0; k <= widths[i]; k++) stream_space(s);
-		}
+static void plan_init(render_plan *p)
+{
+	memset(p, 0, sizeof(render_plan));
 
-		stream_puts(s, _("|"));
-		stream_newline(s);
-		j++;
+	output_glyphs(&p->g);
 
-	} while(more_lines);
+	piece_set(&p->gap, 0, p->g.bar, " ");
+	piece_set(&p->end, 0, p->g.bar, "\n");
+}
+
+static void plan_free(render_plan *p)
+{
+	int i;
 
-	free(pos);
+	for(i = 0; i < 3; i++) free(p->lines[i].text);
+	free(p->gap.text);
+	free(p->end.text);
+	free(p->widths);
 }
 
-void output_horiz(results *res, stream *s)
+/*
+  Build the separator lines for the given column widths, unless
+  they're the ones we already have.
+*/
+static void plan_lines(render_plan *p, int widths[], int ncols)
 {
-	res_dims *dims;
-	int ncols, i, j;
-	int *col_widths;
+	size_t dash_len, len;
+	char *q;
+	vpos v;
+	int i, j;
 
-	ncols = res_get_ncols(res);
+	if(p->widths && p->ncols == ncols &&
+	   !memcmp(p->widths, widths, ncols * sizeof(int))) return;
 
-	translate_resultset(res);
-	dims = get_resultset_dimensions(res);
+	if(!(p->widths = realloc(p->widths, ncols * sizeof(int)))) err_system();
+	memcpy(p->widths, widths, ncols * sizeof(int));
+	p->ncols = ncols;
 
-	if(!(col_widths = calloc(ncols, sizeof(int)))) err_system();
-	for(i = 0; i < ncols; i++) {
+	dash_len = strlen(p->g.dash);
+
+	for(v = VPOS_TOP; v <= VPOS_BOT; v++) {
+		len = strlen(p->g.box[v][HPOS_RIG]) + 1;
+		for(i = 0; i < ncols; i++)
+			len += strlen(p->g.box[v][i ? HPOS_MID : HPOS_LEF]) + (widths[i] + 2) * dash_len;
 
-		col_widths[i] = dims->col_dims[i]->max_width;
+		free(p->lines[v].text);
+		if(!(p->lines[v].text = q = malloc(len + 1))) err_system();
+		p->lines[v].len = len;
 
-		for(j = 0; j < res_get_nrows(res); j++) {
-			if(dims->row_dims[j * ncols + i]->max_width > col_widths[i])
-				col_widths[i] = dims->row_dims[j * ncols + i]->max_width;
+		for(i = 0; i < ncols; i++) {
+			q = append(q, p->g.box[v][i ? HPOS_MID : HPOS_LEF]);
+			for(j = 0; j < widths[i] + 2; j++) q = append(q, p->g.dash);
 		}
+		q = append(q, p->g.box[v][HPOS_RIG]);
+		append(q, "\n");
 	}
+}
 
-	output_horiz_separator(s, col_widths, ncols, VPOS_TOP);
-	output_horiz_row(s, res_get_cols(res), dims->col_dims, col_widths, ncols);
-	output_horiz_separator(s, col_widths, ncols, VPOS_MID);
+static void output_size(results *res, stream *s)
+{
+	int nrows;
 
-	j = 0;
-	while(res_next_row(res)) {
-		output_horiz_row(s, res_get_row(res),
-				 dims->row_dims + (j * ncols),
-				 col_widths, ncols);
-		j++;
-	};
+	nrows = res_get_nrows(res);
+	stream_printf(s,
+		      ngettext("1 row in set\n", "%d rows in set\n", nrows),
+		      nrows);
+}
 
-	output_horiz_separator(s, col_widths, ncols, VPOS_BOT);
+static int option_enabled(const char *name)
+{
+	const char *v;
 
-	free(col_widths);
-	free_resultset_dimensions(res, dims);
+	v = getenv(name);
+	if(!v) return 0;
 
-	output_size(res, s);
+	return strcmp(v, "Off") && strcmp(v, "off") && strcmp(v, "0");
 }
 
-void output_vert_separator(stream *s, int col_width, int row_width, vpos v)
+static int stream_sample_rows()
 {
-	int k;
+	const char *v;
+	int n;
 
-	stream_puts(s, get_box_char(v, HPOS_LEF));
-	for(k = 0; k <= col_width + 1; k++) stream_puts(s, _("-"));
-	stream_puts(s, get_box_char(v, HPOS_MID));
-	for(k = 0; k <= row_width + 1; k++) stream_puts(s, _("-"));
-	stream_puts(s, get_box_char(v, HPOS_RIG));
-	stream_newline(s);
+	if(!(v = getenv("DBSH_STREAM_ROWS"))) return STREAM_SAMPLE_ROWS;
+
+	n = atoi(v);
+	return n > 0 ? n : 1;
 }
 
-void output_vert(results *res, stream *s)
+static int stream_truncates()
 {
-	res_dims *dims;
-	int col_width, row_width, ncols, i, j, k, l;
-	vpos v;
-	wchar_t *p;
+	const char *v;
 
+	v = getenv("DBSH_STREAM_OVERFLOW");
+	return v && !strcmp(v, "truncate");
+}
 
-	ncols = res_get_ncols(res);
+/*
+  Whether to format rows with a pool of threads (see format.c).  Not
+  for terminals, where rows should appear as soon as they can.
+*/
+static int parallel(stream *s)
+{
+	return !stream_isatty(s) && format_threads() > 1;
+}
 
-	translate_resultset(res);
-	dims = get_resultset_dimensions(res);
+/*
+  Hand each row of the set to a formatter.  It keeps copies of the
+  values, so rows can be let go of as soon as they're added.
+*/
+static void format_rows(results *res, stream *s, format_fn fn, void *arg)
+{
+	formatter *f;
+	int n;
 
-	col_width = 0;
-	row_width = 0;
-	for(i = 0; i < ncols; i++) {
-		if(dims->col_dims[i]->max_width > col_width) col_width = dims->col_dims[i]->max_width;
+	f = format_create(s, res_get_ncols(res), fn, arg);
 
-		for(j = 0; j < res_get_nrows(res); j++) {
-			if(dims->row_dims[j * ncols + i]->max_width > row_width)
-				row_width = dims->row_dims[j * ncols + i]->max_width;
-		}
+	for(n = 1; res_next_row(res); n++) {
+		format_row(f, res_get_mb_row(res));
+		if(n % RELEASE_ROWS == 0) res_discard_rows(res);
 	}
 
-	v = VPOS_TOP;
+	format_finish(f);
+}
 
-	j = 0;
-	while(res_next_row(res)) {
-		output_vert_separator(s, col_width, row_width, v);
+static csv_quote csv_quoting()
+{
+	const char *v;
 
-		for(i = 0; i < ncols; i++) {
+	if(!(v = getenv("DBSH_CSV_QUOTE"))) return CSV_QUOTE_ALWAYS;
 
-			l = 0;
+	if(!strcmp(v, "minimal")) return CSV_QUOTE_MINIMAL;
+	if(!strcmp(v, "never")) return CSV_QUOTE_NEVER;
+	return CSV_QUOTE_ALWAYS;
+}
 
-			stream_puts(s, _("|"));
-			for(k = 0; k <= col_width - dims->col_dims[i]->widths[0]; k++) stream_space(s);
+/*
+  Cut each line of a cell down to width, marking the lines that were
+  cut.  Done in place, since the text can only get shorter.
+*/
+static void truncate_cell(dim *d, int width)
+{
+	const wchar_t *p;
+	wchar_t *q;
+	int line, l, w;
 
-			for(p = res_get_col(res, i); *p; p++) {
-				if(*p == '\t') stream_putws(s, L"        ");
-				else stream_putwc(s, *p);
-			}
+	p = q = d->text;
 
-			stream_space(s);
-			stream_puts(s, _("|"));
-			stream_space(s);
-
-			for(p = res_get_value(res, i); *p; p++) {
-				if(*p == L'\n') {
-					for(k = 0; k < row_width - dims->row_dims[j * ncols + i]->widths[l] + 1; k++) stream_space(s);
-					stream_puts(s, _("|"));
-					stream_newline(s);
-					stream_puts(s, _("|"));
-					for(k = 0; k < col_width + 2; k++) stream_space(s);
-					stream_puts(s, _("|"));
-					stream_space(s);
-					l++;
-				} else if(*p == L'\t') {
-					stream_putws(s, L"        ");
-				} else {
-					stream_putwc(s, *p);
-				}
+	for(line = 0; line < d->lines; line++) {
+		if(d->widths[line] <= width) {
+			while(*p && *p != L'\n') *q++ = *p++;
+		} else {
+			for(l = 0; *p && *p != L'\n'; p++) {
+				w = char_width(*p);
+				if(l + w > width - 1) break;
+				*q++ = *p;
+				l += w;
 			}
+			while(*p && *p != L'\n') p++;
 
-			for(k = 0; k < row_width - dims->row_dims[j * ncols + i]->widths[l] + 1; k++) stream_space(s);
-			stream_puts(s, _("|"));
-			stream_newline(s);
+			*q++ = TRUNCATED_MARKER;
+			d->widths[line] = l + char_width(TRUNCATED_MARKER);
 		}
 
-		v = VPOS_MID;
+		if(*p) *q++ = *p++;
+	}
 
-		j++;
-	};
+	*q = 0;
+	d->len = q - d->text;
+
+	d->max_width = 0;
+	for(line = 0; line < d->lines; line++)
+		if(d->widths[line] > d->max_width) d->max_width = d->widths[line];
+}
+
+static void output_horiz_separator(stream *s, render_plan *plan,
+				   int widths[], int ncols, vpos v)
+{
+	plan_lines(plan, widths, ncols);
+	put_piece(s, &plan->lines[v], 0);
+}
 
-	if(j) output_vert_separator(s, col_width, row_width, VPOS_BOT);
+static const wchar_t *output_line(stream *s, const wchar_t *p)
+{
+	size_t n;
 
-	free_resultset_dimensions(res, dims);
+	for(;;) {
+		n = wcscspn(p, L"\t\n");
+		stream_putwcs(s, p, n);
+		p += n;
 
-	output_size(res, s);
+		if(*p != L'\t') return p;
+		stream_spaces(s, 8);
+		p++;
+	}
 }
 
-void output_csv_row(stream *s, wchar_t **data, int ncols, wchar_t sep, wchar_t delim)
+static void output_horiz_row(stream *s, render_plan *plan, dim *cells,
+			     int widths[], int ncols)
 {
-	int i;
 	const wchar_t *p;
+	int i, j, pad, more_lines;
 
-	for(i = 0; i < ncols; i++) {
+	for(i = 0; i < ncols; i++) cells[i].pos = cells[i].text;
 
-		if(delim) stream_putwc(s, delim);
+	j = 0;
+	do {
+		more_lines = 0;
+		pad = 0;
 
-		if(data[i]) {
-			for(p = data[i]; *p; p++) {
-				if(*p == delim) stream_putwc(s, delim);
-				stream_putwc(s, *p);
-			}
-		}
+		for(i = 0; i < ncols; i++) {
+			put_piece(s, &plan->gap, pad);
 
-		if(delim) stream_putwc(s, delim);
+			p = output_line(s, cells[i].pos);
+			if(*p) {
+				cells[i].pos = p + 1;
+				more_lines = 1;
+			} else cells[i].pos = p;
 
-		if(i < ncols - 1) stream_putwc(s, sep);
-	}
+			pad = widths[i] - (j < cells[i].lines ? cells[i].widths[j] : 0) + 1;
+		}
 
-	stream_newline(s);
+		put_piece(s, &plan->end, pad);
+		j++;
+
+	} while(more_lines);
 }
 
-void output_csv(results *res, stream *s, char separator, char delimiter)
+static void output_horiz_header(stream *s, render_plan *plan, dim *head,
+				int widths[], int ncols)
 {
-	output_csv_row(s, res_get_cols(res), res_get_ncols(res), separator, delimiter);
-	while(res_next_row(res)) {
-		output_csv_row(s, res_get_row(res), res_get_ncols(res), separator, delimiter);
-	};
+	output_horiz_separator(s, plan, widths, ncols, VPOS_TOP);
+	output_horiz_row(s, plan, head, widths, ncols);
+	output_horiz_separator(s, plan, widths, ncols, VPOS_MID);
 }
 
-void output_flat(results *res, stream *s)
+typedef struct {
+	render_plan *plan;
+	int *widths;
+} horiz_args;
+
+/*
+  Runs in a formatter's threads: the plan's pieces must already have
+  room for any padding, so that writing them doesn't change them.
+*/
+static void format_horiz(stream *s, char **rows, int nrows, int ncols,
+			 long first, void *arg)
 {
-	int i;
+	horiz_args *a;
+	dim *cells;
+	wchar_t *buf;
+	size_t cap;
+	int i, j;
 
-	while(res_next_row(res)) {
-		for(i = 0; i < res_get_ncols(res); i++) {
-			if(res_get_value(res, i)) {
-				stream_putws(s, res_get_col(res, i));
-				stream_newline(s);
-				stream_putws(s, res_get_value(res, i));
-				stream_newline(s);
-				stream_newline(s);
-			}
-		}
-	};
+	a = arg;
+	cells = dims_alloc(ncols);
+	buf = 0;
+	cap = 0;
+
+	for(j = 0; j < nrows; j++, rows += ncols) {
+		for(i = 0; i < ncols; i++)
+			measure(&cells[i], rows[i] ? text_widen(&buf, &cap, rows[i]) : 0, 1);
+		output_horiz_row(s, a->plan, cells, a->widths, ncols);
+	}
+
+	free(buf);
+	dims_free(cells, ncols);
 }
 
-void output_list(results *res, stream *s)
+void output_horiz(results *res, stream *s)
 {
-	int i;
+	int ncols, i;
+	int *col_widths;
+	dim *head, *cells;
+	render_plan plan;
+	horiz_args args;
 
-	for(i = 0; i < res_get_ncols(res); i++) {
-		stream_putws(s, res_get_col(res, i));
-		stream_putws(s, L": ");
+	ncols = res_get_ncols(res);
+	head = dims_alloc(ncols);
+	cells = dims_alloc(ncols);
+	plan_init(&plan);
+
+	res_phase_stop(res, RES_PHASE_OUTPUT);
+	res_phase_start(res, RES_PHASE_LAYOUT);
+	measure_headings(res, head);
+	col_widths = get_column_widths(res, head);
+	res_phase_stop(res, RES_PHASE_LAYOUT);
+	res_phase_start(res, RES_PHASE_OUTPUT);
+
+	output_horiz_header(s, &plan, head, col_widths, ncols);
 
+	if(parallel(s)) {
+		for(i = 0; i < ncols; i++) {
+			piece_reserve(&plan.gap, col_widths[i] + 1);
+			piece_reserve(&plan.end, col_widths[i] + 1);
+		}
+
+		args.plan = &plan;
+		args.widths = col_widths;
+		format_rows(res, s, format_horiz, &args);
+	} else {
 		while(res_next_row(res)) {
-			if(res_get_value(res, i)) {
-				stream_putws(s, res_get_value(res, i));
-				if(res_more_rows(res)) stream_putwc(s, L',');
-			}
+			measure_row(res, cells);
+			output_horiz_row(s, &plan, cells, col_widths, ncols);
 		};
-
-		stream_newline(s);
 	}
+
+	output_horiz_separator(s, &plan, col_widths, ncols, VPOS_BOT);
+
+	plan_free(&plan);
+	free(col_widths);
+	dims_free(head, ncols);
+	dims_free(cells, ncols);
+
+	output_size(res, s);
 }
 
-void output_results(results *res, char mode, stream *s)
+/*
+  Streaming version of output_horiz(): column widths come from the
+  headings and the first DBSH_STREAM_ROWS rows, which are printed as
+  soon as they've been fetched; rows after that are printed as they
+  arrive.  A later value too wide for its column either gets the
+  header printed again with wider columns or, with
+  DBSH_STREAM_OVERFLOW=truncate, is cut short.  Only the sample's
+  worth of rows is held at any time.
+*/
+void output_horiz_stream(results *res, stream *s)
 {
-	wchar_t *w;
-	int nrows;
-	struct timeval time_taken;
+	int ncols, sample, truncate, n, i, j, wider;
+	int *widths;
+	dim *head, *cells;
+	render_plan plan;
 
-	if(mode == 1) mode = *getenv("DBSH_DEFAULT_ACTION");
+	ncols = res_get_ncols(res);
+	sample = stream_sample_rows();
+	truncate = stream_truncates();
 
-	while((w = res_next_warning(res))) {
-		stream_putws(s, w);
-		stream_newline(s);
-	}
+	head = dims_alloc(ncols);
+	cells = dims_alloc(ncols);
+	plan_init(&plan);
+	if(!(widths = calloc(ncols, sizeof(int)))) err_system();
+
+	res_phase_stop(res, RES_PHASE_OUTPUT);
+	res_phase_start(res, RES_PHASE_LAYOUT);
+
+	measure_headings(res, head);
+	for(i = 0; i < ncols; i++) widths[i] = head[i].max_width;
+
+	for(n = 0; n < sample && res_next_row(res); n++) {
+		measure_row(res, cells);
+		for(i = 0; i < ncols; i++)
+			if(cells[i].max_width > widths[i]) widths[i] = cells[i].max_width;
+	}
+
+	res_phase_stop(res, RES_PHASE_LAYOUT);
+	res_phase_start(res, RES_PHASE_OUTPUT);
+
+	output_horiz_header(s, &plan, head, widths, ncols);
+	for(j = 0; j < n; j++) {
+		res_get_row_at(res, j);
+		measure_row(res, cells);
+		output_horiz_row(s, &plan, cells, widths, ncols);
+	}
+
+	res_discard_rows(res);
+
+	j = 0;
+	while(res_next_row(res)) {
+		res_phase_stop(res, RES_PHASE_OUTPUT);
+		res_phase_start(res, RES_PHASE_LAYOUT);
+
+		measure_row(res, cells);
+
+		wider = 0;
+		for(i = 0; i < ncols; i++) {
+			if(cells[i].max_width <= widths[i]) continue;
+
+			if(truncate) {
+				truncate_cell(&cells[i], widths[i]);
+			} else {
+				if(!wider) output_horiz_separator(s, &plan, widths, ncols, VPOS_BOT);
+				widths[i] = cells[i].max_width;
+				wider = 1;
+			}
+		}
+
+		res_phase_stop(res, RES_PHASE_LAYOUT);
+		res_phase_start(res, RES_PHASE_OUTPUT);
+
+		if(wider) output_horiz_header(s, &plan, head, widths, ncols);
+		output_horiz_row(s, &plan, cells, widths, ncols);
+
+		if(++j == sample) {
+			res_discard_rows(res);
+			j = 0;
+		}
+	}
+
+	output_horiz_separator(s, &plan, widths, ncols, VPOS_BOT);
+
+	plan_free(&plan);
+	free(widths);
+	dims_free(head, ncols);
+	dims_free(cells, ncols);
+
+	output_size(res, s);
+}
+
+static void output_vert_separator(stream *s, render_plan *plan,
+				  int col_width, int row_width, vpos v)
+{
+	int widths[2];
+
+	widths[0] = col_width;
+	widths[1] = row_width;
+	output_horiz_separator(s, plan, widths, 2, v);
+}
+
+static void output_vert_record(stream *s, render_plan *plan, dim *cells,
+			       dim *head, int ncols, int col_width, int row_width)
+{
+	int i, l;
+	const wchar_t *p;
+
+	for(i = 0; i < ncols; i++) {
+
+		l = 0;
+
+		stream_puts(s, plan->g.bar);
+		stream_spaces(s, col_width - head[i].widths[0] + 1);
+
+		for(p = output_line(s, head[i].text); *p; p = output_line(s, p + 1))
+			stream_newline(s);
+
+		put_piece(s, &plan->gap, 1);
+
+		for(p = output_line(s, cells[i].text); *p; p = output_line(s, p + 1)) {
+			put_piece(s, &plan->end, row_width - cells[i].widths[l] + 1);
+			stream_puts(s, plan->g.bar);
+			put_piece(s, &plan->gap, col_width + 2);
+			l++;
+		}
+
+		put_piece(s, &plan->end, row_width - cells[i].widths[l] + 1);
+	}
+}
+
+static int get_col_width(dim *head, int ncols)
+{
+	int col_width, i;
+
+	col_width = 0;
+	for(i = 0; i < ncols; i++)
+		if(head[i].max_width > col_width) col_width = head[i].max_width;
+
+	return col_width;
+}
+
+void output_vert(results *res, stream *s)
+{
+	dim *head, *cells;
+	int *widths;
+	int col_width, row_width, ncols, i, j;
+	render_plan plan;
+	vpos v;
+
+	ncols = res_get_ncols(res);
+	head = dims_alloc(ncols);
+	cells = dims_alloc(ncols);
+	plan_init(&plan);
+
+	res_phase_stop(res, RES_PHASE_OUTPUT);
+	res_phase_start(res, RES_PHASE_LAYOUT);
+	measure_headings(res, head);
+	col_width = get_col_width(head, ncols);
+	widths = get_column_widths(res, head);
+
+	row_width = 0;
+	for(i = 0; i < ncols; i++)
+		if(widths[i] > row_width) row_width = widths[i];
+	free(widths);
+	res_phase_stop(res, RES_PHASE_LAYOUT);
+	res_phase_start(res, RES_PHASE_OUTPUT);
+
+	v = VPOS_TOP;
+
+	j = 0;
+	while(res_next_row(res)) {
+		measure_row(res, cells);
+		output_vert_separator(s, &plan, col_width, row_width, v);
+		output_vert_record(s, &plan, cells, head, ncols, col_width, row_width);
+
+		v = VPOS_MID;
+
+		j++;
+	};
+
+	if(j) output_vert_separator(s, &plan, col_width, row_width, VPOS_BOT);
+
+	plan_free(&plan);
+	dims_free(head, ncols);
+	dims_free(cells, ncols);
+
+	output_size(res, s);
+}
+
+/*
+  Streaming version of output_vert(): the name column is sized from
+  the headings alone and the value column from each record in turn,
+  so records are printed as they're fetched.  Each record is boxed at
+  its own width.
+*/
+void output_vert_stream(results *res, stream *s)
+{
+	dim *head, *cells;
+	int col_width, row_width, ncols, sample, i, j;
+	render_plan plan;
+
+	ncols = res_get_ncols(res);
+	sample = stream_sample_rows();
+
+	head = dims_alloc(ncols);
+	cells = dims_alloc(ncols);
+	plan_init(&plan);
+
+	measure_headings(res, head);
+	col_width = get_col_width(head, ncols);
+
+	j = 0;
+	while(res_next_row(res)) {
+		res_phase_stop(res, RES_PHASE_OUTPUT);
+		res_phase_start(res, RES_PHASE_LAYOUT);
+
+		measure_row(res, cells);
+		row_width = 0;
+		for(i = 0; i < ncols; i++)
+			if(cells[i].max_width > row_width) row_width = cells[i].max_width;
+
+		res_phase_stop(res, RES_PHASE_LAYOUT);
+		res_phase_start(res, RES_PHASE_OUTPUT);
+
+		output_vert_separator(s, &plan, col_width, row_width, VPOS_TOP);
+		output_vert_record(s, &plan, cells, head, ncols, col_width, row_width);
+		output_vert_separator(s, &plan, col_width, row_width, VPOS_BOT);
+
+		if(++j % sample == 0) res_discard_rows(res);
+	}
+
+	plan_free(&plan);
+	dims_free(head, ncols);
+	dims_free(cells, ncols);
+
+	output_size(res, s);
+}
+
+/*
+  CSV, TSV and flat output write values as the bytes the driver gave
+  us.  The separators and delimiter are ASCII, and no multibyte
+  encoding we support uses ASCII bytes inside a character, so
+  searching the bytes for them is safe.  If stable is set the values
+  stay put until the stream is next flushed, so large ones are written
+  from where they are.
+
+  Minimal quoting only quotes values containing the separator, the
+  delimiter or a line break, plus empty strings so they can still be
+  told from NULL.  Without quoting (as for TSV) values go out as they
+  are.
+*/
+static void output_csv_value(stream *s, const char *p, char sep, char delim,
+			     csv_quote quote,
+			     void (*write)(stream *, const char *, size_t))
+{
+	const char *q, *end;
+	size_t n;
+
+	if(!delim || quote == CSV_QUOTE_NEVER) {
+		write(s, p, strlen(p));
+		return;
+	}
+
+	n = text_csv_run(p, sep, delim);
+
+	if(!p[n]) {
+		if(quote == CSV_QUOTE_MINIMAL && n) {
+			write(s, p, n);
+		} else {
+			stream_write(s, &delim, 1);
+			write(s, p, n);
+			stream_write(s, &delim, 1);
+		}
+		return;
+	}
+
+	end = p + n + strlen(p + n);
+
+	stream_write(s, &delim, 1);
+	for(q = p + n; (q = memchr(q, delim, end - q)); p = ++q) {
+		write(s, p, q - p + 1);
+		stream_write(s, &delim, 1);
+	}
+	write(s, p, end - p);
+	stream_write(s, &delim, 1);
+}
+
+static void output_csv_row(stream *s, char **data, int ncols, char sep,
+			   char delim, csv_quote quote, int stable)
+{
+	void (*write)(stream *, const char *, size_t);
+	int i;
+
+	write = stable ? stream_write_ref : stream_write;
+
+	for(i = 0; i < ncols; i++) {
+		if(data[i]) output_csv_value(s, data[i], sep, delim, quote, write);
+		else if(delim && quote == CSV_QUOTE_ALWAYS) {
+			stream_write(s, &delim, 1);
+			stream_write(s, &delim, 1);
+		}
+
+		if(i < ncols - 1) stream_write(s, &sep, 1);
+	}
+
+	stream_newline(s);
+}
+
+static char **get_mb_cols(results *res)
+{
+	char **cols;
+	wchar_t *w;
+	size_t l;
+	int i;
+
+	if(!(cols = calloc(res_get_ncols(res), sizeof(char *)))) err_system();
+
+	for(i = 0; i < res_get_ncols(res); i++) {
+		w = res_get_col(res, i);
+		if((l = wcstombs(0, w, 0)) == -1) err_system();
+		if(!(cols[i] = malloc(l + 1))) err_system();
+		wcstombs(cols[i], w, l + 1);
+	}
+
+	return cols;
+}
+
+static void free_mb_cols(char **cols, int ncols)
+{
+	int i;
+
+	for(i = 0; i < ncols; i++) free(cols[i]);
+	free(cols);
+}
+
+/*
+  Called after each row is written: every so often, let go of the rows
+  written so far, so that long exports run in constant memory.  Output
+  may still refer to them, so it's flushed first.
+*/
+static void release_rows(results *res, stream *s, int *n)
+{
+	if(++*n % RELEASE_ROWS) return;
+
+	stream_flush(s);
+	res_discard_rows(res);
+}
+
+typedef struct {
+	char sep;
+	char delim;
+	csv_quote quote;
+} csv_args;
+
+static void format_csv(stream *s, char **rows, int nrows, int ncols,
+		       long first, void *arg)
+{
+	csv_args *a;
+	int j;
+
+	a = arg;
+
+	for(j = 0; j < nrows; j++, rows += ncols)
+		output_csv_row(s, rows, ncols, a->sep, a->delim, a->quote, 0);
+}
+
+void output_csv(results *res, stream *s, char separator, char delimiter)
+{
+	char **cols;
+	csv_args args;
+	int n;
+
+	args.sep = separator;
+	args.delim = delimiter;
+	args.quote = csv_quoting();
+
+	cols = get_mb_cols(res);
+	output_csv_row(s, cols, res_get_ncols(res), separator, delimiter, args.quote, 0);
+	free_mb_cols(cols, res_get_ncols(res));
+
+	if(parallel(s)) format_rows(res, s, format_csv, &args);
+	else for(n = 0; res_next_row(res); ) {
+		output_csv_row(s, res_get_mb_row(res), res_get_ncols(res),
+			       separator, delimiter, args.quote, res_row_is_stable(res));
+		release_rows(res, s, &n);
+	}
+
+	// the values may not outlive the results
+	stream_flush(s);
+}
+
+void output_flat(results *res, stream *s)
+{
+	int i, n;
+
+	for(n = 0; res_next_row(res); ) {
+		for(i = 0; i < res_get_ncols(res); i++) {
+			if(res_get_mb_value(res, i)) {
+				stream_putws(s, res_get_col(res, i));
+				stream_newline(s);
+				stream_puts(s, res_get_mb_value(res, i));
+				stream_newline(s);
+				stream_newline(s);
+			}
+		}
+		release_rows(res, s, &n);
+	}
+}
+
+void output_list(results *res, stream *s)
+{
+	int i, j;
+	res_column c;
+	const char *v;
+
+	for(i = 0; i < res_get_ncols(res); i++) {
+		stream_putws(s, res_get_col(res, i));
+		stream_putws(s, L": ");
+
+		if(res_get_column(res, i, &c)) {
+			for(j = 0; j < c.nrows; j++) {
+				if((v = RES_COLUMN_VALUE(&c, j))) {
+					stream_puts(s, v);
+					if(j + 1 < c.nrows) stream_putwc(s, L',');
+				}
+			}
+
+			stream_newline(s);
+			continue;
+		}
+
+		while(res_next_row(res)) {
+			if(res_get_mb_value(res, i)) {
+				stream_puts(s, res_get_mb_value(res, i));
+				if(res_more_rows(res)) stream_putwc(s, L',');
+			}
+		};
+
+		stream_newline(s);
+	}
+}
+
+/*
+  Write the JSON escape for c, one of the characters text_json_run()
+  stops at, to out (which must have room for 6 bytes).  Returns its
+  length.
+*/
+static int json_escape(char c, char *out)
+{
+	const char *hex = "0123456789abcdef";
+
+	out[0] = '\\';
+
+	switch(c) {
+	case '"':  out[1] = '"';  return 2;
+	case '\\': out[1] = '\\'; return 2;
+	case '\b': out[1] = 'b';  return 2;
+	case '\f': out[1] = 'f';  return 2;
+	case '\n': out[1] = 'n';  return 2;
+	case '\r': out[1] = 'r';  return 2;
+	case '\t': out[1] = 't';  return 2;
+	}
+
+	memcpy(out + 1, "u00", 3);
+	out[4] = hex[(c >> 4) & 0xf];
+	out[5] = hex[c & 0xf];
+	return 6;
+}
+
+static void output_json_string(stream *s, const char *p,
+			       void (*write)(stream *, const char *, size_t))
+{
+	char esc[6];
+	size_t n;
+
+	stream_write(s, "\"", 1);
+
+	for(;;) {
+		n = text_json_run(p);
+		write(s, p, n);
+		p += n;
+
+		if(!*p) break;
+		stream_write(s, esc, json_escape(*p++, esc));
+	}
+
+	stream_write(s, "\"", 1);
+}
+
+/*
+  Whether p is a number as JSON would have it: the driver's idea of a
+  number (eg ".5", "1e+", "Infinity") isn't always.
+*/
+static int json_number(const char *p)
+{
+	if(*p == '-') p++;
+
+	if(*p == '0') p++;
+	else if(*p >= '1' && *p <= '9') while(*p >= '0' && *p <= '9') p++;
+	else return 0;
+
+	if(*p == '.') {
+		if(*++p < '0' || *p > '9') return 0;
+		while(*p >= '0' && *p <= '9') p++;
+	}
+
+	if(*p == 'e' || *p == 'E') {
+		if(*++p == '+' || *p == '-') p++;
+		if(*p < '0' || *p > '9') return 0;
+		while(*p >= '0' && *p <= '9') p++;
+	}
+
+	return !*p;
+}
+
+/*
+  The text that goes before each value in an object: the opening brace
+  or a comma, then the column name as a key.
+*/
+static char **json_keys(results *res)
+{
+	char **cols, **keys, esc[6];
+	const char *p;
+	size_t n, len;
+	char *q;
+	int i, ncols;
+
+	ncols = res_get_ncols(res);
+	cols = get_mb_cols(res);
+	if(!(keys = calloc(ncols, sizeof(char *)))) err_system();
+
+	for(i = 0; i < ncols; i++) {
+		// at worst every byte becomes \u00XX
+		if(!(keys[i] = q = malloc(strlen(cols[i]) * 6 + 5))) err_system();
+
+		*q++ = i ? ',' : '{';
+		*q++ = '"';
+
+		for(p = cols[i]; ; ) {
+			n = text_json_run(p);
+			memcpy(q, p, n);
+			q += n;
+			p += n;
+
+			if(!*p) break;
+			len = json_escape(*p++, esc);
+			memcpy(q, esc, len);
+			q += len;
+		}
+
+		memcpy(q, "\":", 3);
+	}
+
+	free_mb_cols(cols, ncols);
+
+	return keys;
+}
+
+typedef struct {
+	char **keys;
+	res_type *types;
+	int lines;
+} json_args;
+
+static void output_json_row(stream *s, char **data, int ncols, json_args *a,
+			    int first,
+			    void (*write)(stream *, const char *, size_t))
+{
+	int i;
+
+	if(!a->lines) stream_puts(s, first ? "\n" : ",\n");
+
+	for(i = 0; i < ncols; i++) {
+		stream_puts(s, a->keys[i]);
+
+		if(!data[i]) stream_write(s, "null", 4);
+		else if(RES_TYPE_IS_NUMBER(a->types[i]) && json_number(data[i]))
+			stream_puts(s, data[i]);
+		else output_json_string(s, data[i], write);
+	}
+
+	stream_puts(s, "}");
+	if(a->lines) stream_newline(s);
+}
+
+static void format_json(stream *s, char **rows, int nrows, int ncols,
+			long first, void *arg)
+{
+	int j;
+
+	for(j = 0; j < nrows; j++, rows += ncols)
+		output_json_row(s, rows, ncols, arg, first + j == 0, stream_write);
+}
+
+/*
+  One object per row, keyed by column name.  By default the objects are
+  written as a JSON array, a row to a line; with DBSH_JSON_FORMAT=lines
+  they're written one to a line and nothing else (NDJSON).  NULLs come
+  out as null, and values of numeric columns unquoted if they're valid
+  JSON numbers.  Either way rows are written as they're fetched.
+*/
+void output_json(results *res, stream *s)
+{
+	const char *format;
+	int i, ncols, n;
+	json_args args;
+
+	ncols = res_get_ncols(res);
+	args.keys = json_keys(res);
+
+	if(!(args.types = malloc(ncols * sizeof(res_type)))) err_system();
+	for(i = 0; i < ncols; i++) args.types[i] = res_get_col_type(res, i);
+
+	format = getenv("DBSH_JSON_FORMAT");
+	args.lines = format && !strcmp(format, "lines");
+
+	if(!args.lines) stream_puts(s, "[");
+
+	if(parallel(s)) format_rows(res, s, format_json, &args);
+	else for(n = 0; res_next_row(res); ) {
+		output_json_row(s, res_get_mb_row(res), ncols, &args, !n,
+				res_row_is_stable(res) ? stream_write_ref : stream_write);
+		release_rows(res, s, &n);
+	}
+
+	if(!args.lines) stream_puts(s, "\n]\n");
+
+	// the values may not outlive the results
+	stream_flush(s);
+
+	for(i = 0; i < ncols; i++) free(args.keys[i]);
+	free(args.keys);
+	free(args.types);
+}
+
+/*
+  The entity for c, one of the characters text_markup_run() stops at,
+  or 0 for a control character.
+*/
+static const char *markup_entity(char c)
+{
+	switch(c) {
+	case '&': return "&amp;";
+	case '<': return "&lt;";
+	case '>': return "&gt;";
+	case '"': return "&quot;";
+	}
+
+	return 0;
+}
+
+/*
+  XML 1.0 allows no control characters other than tab, newline and
+  carriage return, even as references, so the rest become '?'.
+*/
+static const char *markup_cntrl(char c, int xml)
+{
+	static char buf[2];
+
+	buf[0] = (!xml || c == '\t' || c == '\n' || c == '\r') ? c : '?';
+	return buf;
+}
+
+static void output_markup_text(stream *s, const char *p, int xml,
+			       void (*write)(stream *, const char *, size_t))
+{
+	const char *e;
+	size_t n;
+
+	for(;;) {
+		n = text_markup_run(p);
+		write(s, p, n);
+		p += n;
+
+		if(!*p) break;
+		if(!(e = markup_entity(*p))) e = markup_cntrl(*p, xml);
+		stream_puts(s, e);
+		p++;
+	}
+}
+
+/*
+  The escaped name of column i, in a new string.
+*/
+static char *markup_col(results *res, int i, int xml)
+{
+	wchar_t *w;
+	char *mb, *r, *q;
+	const char *p, *e;
+	size_t l, n;
+
+	w = res_get_col(res, i);
+	if((l = wcstombs(0, w, 0)) == -1) err_system();
+	if(!(mb = malloc(l + 1))) err_system();
+	wcstombs(mb, w, l + 1);
+
+	// at worst every byte becomes &quot;
+	if(!(r = q = malloc(l * 6 + 1))) err_system();
+
+	for(p = mb; ; p++) {
+		n = text_markup_run(p);
+		memcpy(q, p, n);
+		q += n;
+		p += n;
+
+		if(!*p) break;
+		if(!(e = markup_entity(*p))) e = markup_cntrl(*p, xml);
+		q += strlen(strcpy(q, e));
+	}
+	*q = 0;
+
+	free(mb);
+	return r;
+}
+
+/*
+  An HTML table with the column names as headings.  NULLs are empty
+  cells.  Rows are written as they're fetched.
+*/
+void output_html(results *res, stream *s)
+{
+	void (*write)(stream *, const char *, size_t);
+	char **data, *col;
+	int i, ncols, n;
+
+	ncols = res_get_ncols(res);
+	n = 0;
+
+	stream_puts(s, "<table>\n<tr>");
+	for(i = 0; i < ncols; i++) {
+		col = markup_col(res, i, 0);
+		stream_puts(s, "<th>");
+		stream_puts(s, col);
+		stream_puts(s, "</th>");
+		free(col);
+	}
+	stream_puts(s, "</tr>\n");
+
+	while(res_next_row(res)) {
+		data = res_get_mb_row(res);
+		write = res_row_is_stable(res) ? stream_write_ref : stream_write;
+
+		stream_puts(s, "<tr>");
+		for(i = 0; i < ncols; i++) {
+			stream_puts(s, "<td>");
+			if(data[i]) output_markup_text(s, data[i], 0, write);
+			stream_puts(s, "</td>");
+		}
+		stream_puts(s, "</tr>\n");
+
+		release_rows(res, s, &n);
+	}
+
+	stream_puts(s, "</table>\n");
+
+	// the values may not outlive the results
+	stream_flush(s);
+}
+
+/*
+  XML in the same form as mysql --xml: a row element per row holding a
+  field element per column, with NULLs marked by xsi:nil.  Rows are
+  written as they're fetched.
+*/
+void output_xml(results *res, stream *s)
+{
+	void (*write)(stream *, const char *, size_t);
+	char **data, **fields, *col;
+	const char *codeset;
+	int i, ncols, n;
+
+	ncols = res_get_ncols(res);
+	n = 0;
+
+	// the start of each field element, up to the end of its name
+	if(!(fields = calloc(ncols, sizeof(char *)))) err_system();
+	for(i = 0; i < ncols; i++) {
+		col = markup_col(res, i, 1);
+		if(!(fields[i] = malloc(strlen(col) + 20))) err_system();
+		sprintf(fields[i], "\t<field name=\"%s\"", col);
+		free(col);
+	}
+
+	codeset = nl_langinfo(CODESET);
+	if(!strcmp(codeset, "ANSI_X3.4-1968")) codeset = "US-ASCII";
+
+	stream_printf(s, "<?xml version=\"1.0\" encoding=\"%s\"?>\n", codeset);
+	stream_puts(s, "<resultset xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">\n");
+
+	while(res_next_row(res)) {
+		data = res_get_mb_row(res);
+		write = res_row_is_stable(res) ? stream_write_ref : stream_write;
+
+		stream_puts(s, "  <row>\n");
+		for(i = 0; i < ncols; i++) {
+			stream_puts(s, fields[i]);
+			if(data[i]) {
+				stream_puts(s, ">");
+				output_markup_text(s, data[i], 1, write);
+				stream_puts(s, "</field>\n");
+			} else stream_puts(s, " xsi:nil=\"true\" />\n");
+		}
+		stream_puts(s, "  </row>\n");
+
+		release_rows(res, s, &n);
+	}
+
+	stream_puts(s, "</resultset>\n");
+
+	// the values may not outlive the results
+	stream_flush(s);
+
+	for(i = 0; i < ncols; i++) free(fields[i]);
+	free(fields);
+}
+
+/*
+  An Arrow IPC stream (see arrow.c), converted as the rows are fetched.
+*/
+static void output_arrow(results *res, stream *s)
+{
+	arrow_writer *w;
+	int n;
+
+	w = arrow_writer_create(res, s);
+
+	n = 0;
+	while(res_next_row(res)) {
+		arrow_writer_row(w, res_get_mb_row(res));
+		release_rows(res, s, &n);
+	}
+
+	arrow_writer_finish(w);
+}
+
+/*
+  Fetch every row and throw it away, converting it to wide characters
+  first if DBSH_NULL_CONVERT is on, counting the rows and the bytes
+  the driver returned.  For timing the fetch on its own.
+*/
+static void output_null(results *res, long *rows, size_t *bytes)
+{
+	char **data;
+	int i, ncols, n, convert;
+
+	ncols = res_get_ncols(res);
+	convert = option_enabled("DBSH_NULL_CONVERT");
+
+	n = 0;
+	while(res_next_row(res)) {
+		data = res_get_mb_row(res);
+		for(i = 0; i < ncols; i++)
+			if(data[i]) *bytes += strlen(data[i]);
+
+		// conversion is part of what's being timed, unlike output
+		if(convert) {
+			res_phase_stop(res, RES_PHASE_OUTPUT);
+			res_phase_start(res, RES_PHASE_CONVERT);
+			res_get_row(res);
+			res_phase_stop(res, RES_PHASE_CONVERT);
+			res_phase_start(res, RES_PHASE_OUTPUT);
+		}
+
+		(*rows)++;
+		if(++n % RELEASE_ROWS == 0) res_discard_rows(res);
+	}
+}
+
+static void output_null_summary(results *res, stream *s, long rows,
+				size_t bytes)
+{
+	struct timeval tv;
+	double t;
+
+	tv = res_time_taken(res);
+	t = tv.tv_sec + tv.tv_usec / 1e6;
+
+	stream_printf(s, _("%ld rows, %lu bytes fetched in %.3fs "
+			   "(%.0f rows/s, %.1fMB/s)\n"),
+		      rows, (unsigned long) bytes, t,
+		      t > 0 ? rows / t : 0.0, t > 0 ? bytes / t / 1e6 : 0.0);
+}
+
+#define TS_ARGS(t) (long) (t).tv_sec, (long) ((t).tv_nsec / 1000)
+#define TV_ARGS(t) (long) (t).tv_sec, (long) (t).tv_usec
+
+static void output_timing(results *res, stream *s)
+{
+	const res_timing *t;
+
+	t = res_get_timing(res);
+
+	stream_printf(s, _("prepare %ld.%06lds, execute %ld.%06lds, "
+			   "first row %ld.%06lds, fetch %ld.%06lds\n"),
+		      TS_ARGS(t->phases[RES_PHASE_PREPARE]),
+		      TS_ARGS(t->phases[RES_PHASE_EXECUTE]),
+		      TS_ARGS(t->phases[RES_PHASE_FIRST_ROW]),
+		      TS_ARGS(t->phases[RES_PHASE_FETCH]));
+	stream_printf(s, _("convert %ld.%06lds, layout %ld.%06lds, "
+			   "output %ld.%06lds\n"),
+		      TS_ARGS(t->phases[RES_PHASE_CONVERT]),
+		      TS_ARGS(t->phases[RES_PHASE_LAYOUT]),
+		      TS_ARGS(t->phases[RES_PHASE_OUTPUT]));
+	stream_printf(s, _("cpu %ld.%06lds user, %ld.%06lds sys, "
+			   "max rss +%ldkB\n"),
+		      TV_ARGS(t->utime), TV_ARGS(t->stime), t->maxrss);
+}
+
+void output_results(results *res, char mode, stream *s)
+{
+	stream *msgs;
+	wchar_t *w;
+	int nrows;
+	long null_rows;
+	size_t null_bytes;
+	struct timeval time_taken;
+
+	if(mode == 1) mode = *getenv("DBSH_DEFAULT_ACTION");
+
+	if(mode == 'A' && stream_isatty(s)) {
+		fputs(_("Arrow output is binary: redirect it to a file or a pipe\n"), stderr);
+		return;
+	}
+
+	// keep binary output clean
+	msgs = mode == 'A' ? stream_create(stderr) : s;
+
+	res_phase_start(res, RES_PHASE_OUTPUT);
+
+	while((w = res_next_warning(res))) {
+		stream_putws(msgs, w);
+		stream_newline(msgs);
+	}
 
 	res_first_set(res);
 
+	null_rows = 0;
+	null_bytes = 0;
+
 	do {
 		nrows = res_get_nrows(res);
 
 		if(nrows == -1) {
-			stream_puts(s, _("Success\n"));
+			stream_puts(msgs, _("Success\n"));
 		} else if(!res_get_ncols(res)) {
-			stream_printf(s,
+			stream_printf(msgs,
 				      ngettext("1 row affected\n",
 					       "%d rows affected\n",
 					       nrows),
 				      nrows);
 		} else {
 			switch(mode) {
+			case 'A':  // Arrow
+				output_arrow(res, s);
+				break;
 			case 'C':  // CSV
 				output_csv(res, s, L',', L'"');
 				break;
@@ -534,34 +1641,76 @@ void output_results(results *res, char mode, stream *s)
 				output_flat(res, s);
 				break;
 			case 'G':  // Vertical
-				output_vert(res, s);
+				if(option_enabled("DBSH_STREAM"))
+					output_vert_stream(res, s);
+				else output_vert(res, s);
 				break;
 			case 'H':  // HTML
-				stream_printf(s, "TODO\n");
+				output_html(res, s);
 				break;
 			case 'J':  // JSON
-				stream_printf(s, "TODO\n");
+				output_json(res, s);
 				break;
 			case 'L':  // List
 				output_list(res, s);
 				break;
+			case 'N':  // Null
+				output_null(res, &null_rows, &null_bytes);
+				break;
 			case 'T':  // TSV
 				output_csv(res, s, L'\t', 0);
 				break;
-			case 'X':  // XMLS
-				stream_printf(s, "TODO\n");
+			case 'X':  // XML
+				output_xml(res, s);
 				break;
 			default:
-				output_horiz(res, s);
+				if(pager_wanted(s))
+					pager_show(res, s);
+				else if(option_enabled("DBSH_STREAM"))
+					output_horiz_stream(res, s);
+				else output_horiz(res, s);
 			}
-			stream_newline(s);
+			if(mode != 'A' && mode != 'N') stream_newline(s);
 		}
 	} while(res_next_set(res));
 
+	if(mode == 'N') output_null_summary(res, s, null_rows, null_bytes);
+
+	if(msgs != s) stream_free(msgs);
+
+	/*
+	  Anything that came up while fetching, such as the memory limit,
+	  would land after the data, so it only goes into s when s is the
+	  terminal.  Otherwise a truncated export would look complete.
+	*/
+	if((w = res_next_warning(res))) {
+		stream_flush(s);
+		msgs = stream_isatty(s) ? s : stream_create(stderr);
+
+		do {
+			stream_putws(msgs, w);
+			stream_newline(msgs);
+		} while((w = res_next_warning(res)));
+
+		if(msgs != s) stream_free(msgs);
+	}
+
+	res_phase_stop(res, RES_PHASE_OUTPUT);
+	res_sample_usage(res);
+
 	time_taken = res_time_taken(res);
 
-	if((mode == 'G' || mode == 'g') &&
-	   (time_taken.tv_sec || time_taken.tv_usec))
+	if(!time_taken.tv_sec && !time_taken.tv_usec) return;
+
+	if(mode == 'G' || mode == 'g') {
 		stream_printf(s, _("(%lu.%06lus)\n"),
 			      time_taken.tv_sec, time_taken.tv_usec);
+		if(mode == 'G' || option_enabled("DBSH_TIMING")) output_timing(res, s);
+	} else if(option_enabled("DBSH_TIMING")) {
+		// keep machine-readable output clean
+		stream_flush(s);
+		s = stream_create(stderr);
+		output_timing(res, s);
+		stream_free(s);
+	}
 }
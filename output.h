@@ -21,6 +21,25 @@
 
 #include <stdio.h>
 
+typedef enum {
+	VPOS_TOP,
+	VPOS_MID,
+	VPOS_BOT
+} vpos;
+
+typedef enum {
+	HPOS_LEF,
+	HPOS_MID,
+	HPOS_RIG
+} hpos;
+
+typedef struct {
+	const char *box[3][3];  // corners and joins, by vpos and hpos
+	const char *bar;
+	const char *dash;
+} glyphs;
+
 void output_results(results *, char, stream *);
+void output_glyphs(glyphs *);
 
 #endif
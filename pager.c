@@ -0,0 +1,623 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+  The built-in pager, used for horizontal output to a terminal when the
+  pager option is "internal".  Instead of formatting the whole result
+  set as text and piping it through a pager, it draws only the rows
+  and columns that fit on the screen, straight from the results, and
+  fetches rows from the cursor only once they're scrolled to.  Column
+  widths grow to fit the widest value shown so far.  Each row takes
+  one line, with line breaks in values shown as <LF> and <CR>.
+
+  Searches look through the values as the driver returned them rather
+  than as they're drawn, so they find what's in the data even where
+  the screen shows it translated or cut short.
+
+  The terminal is driven with ANSI escape sequences, on the alternate
+  screen so that what was there before comes back afterwards.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "cntrl.h"
+#include "common.h"
+#include "err.h"
+#include "output.h"
+#include "pager.h"
+#include "results.h"
+#include "stream.h"
+#include "text.h"
+
+#define PAGER_POLL_MS 250  // how often to check for the terminal being resized
+#define PAGER_ESCAPE_MS 50
+#define PAGER_SEARCH_MAX 256
+
+enum {
+	KEY_RESIZE = 256,
+	KEY_UP,
+	KEY_DOWN,
+	KEY_LEFT,
+	KEY_RIGHT,
+	KEY_PGUP,
+	KEY_PGDN,
+	KEY_HOME,
+	KEY_END,
+	KEY_OTHER
+};
+
+typedef struct {
+	results *res;
+	stream *s;
+	glyphs g;
+	int ncols;
+	int *widths;  // the widest value shown so far
+	int *shown;   // how much of each column fits on the screen
+	int lines;
+	int columns;
+	int top;      // the first row on the screen
+	int left;     // and the first and last columns
+	int right;
+	int match_row;
+	int match_col;
+	char *search;
+	const char *message;
+} pager;
+
+
+static int get_size(pager *);
+static int body_lines(pager *);
+static int read_key(pager *);
+static const wchar_t *glyph(wchar_t, wchar_t *, int *);
+static int value_width(const wchar_t *);
+static void put_value(stream *, const wchar_t *, int);
+static void layout(pager *);
+static void draw(pager *);
+static void draw_rule(pager *, vpos);
+static void draw_row(pager *, wchar_t **, int);
+static void draw_status(pager *);
+static int row_exists(pager *, int);
+static void scroll(pager *, int);
+static int prompt(pager *);
+static void find(pager *, int);
+
+
+/*
+  Whether results for s should go through the built-in pager: only if
+  both ends of the session are a terminal.
+*/
+int pager_wanted(stream *s)
+{
+	const char *v;
+
+	v = getenv("DBSH_DEFAULT_PAGER");
+
+	return v && !strcmp(v, PAGER_INTERNAL) && stream_isatty(s) &&
+		isatty(STDIN_FILENO);
+}
+
+/*
+  Page through the current set until the user quits.  Whatever hasn't
+  been fetched by then is dropped rather than fetched for nothing.
+*/
+void pager_show(results *res, stream *s)
+{
+	struct termios saved, raw;
+	pager p;
+	int i, quit;
+
+	memset(&p, 0, sizeof(p));
+	p.res = res;
+	p.s = s;
+	p.ncols = res_get_ncols(res);
+	p.match_row = -1;
+	output_glyphs(&p.g);
+
+	if(!(p.widths = calloc(p.ncols, sizeof(int)))) err_system();
+	if(!(p.shown = calloc(p.ncols, sizeof(int)))) err_system();
+	for(i = 0; i < p.ncols; i++) p.widths[i] = value_width(res_get_col(res, i));
+
+	get_size(&p);
+
+	if(tcgetattr(STDIN_FILENO, &saved)) err_system();
+	raw = saved;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw)) err_system();
+
+	stream_puts(s, "\033[?1049h\033[?25l");
+
+	for(quit = 0; !quit; ) {
+		draw(&p);
+		p.message = 0;
+
+		switch(read_key(&p)) {
+		case 'q':
+		case 'Q':
+		case 27:
+			quit = 1;
+			break;
+		case 'j':
+		case '\n':
+		case '\r':
+		case KEY_DOWN:
+			scroll(&p, 1);
+			break;
+		case 'k':
+		case KEY_UP:
+			scroll(&p, -1);
+			break;
+		case ' ':
+		case 'f':
+		case KEY_PGDN:
+			scroll(&p, body_lines(&p));
+			break;
+		case 'b':
+		case KEY_PGUP:
+			scroll(&p, -body_lines(&p));
+			break;
+		case 'g':
+		case '<':
+		case KEY_HOME:
+			p.top = 0;
+			break;
+		case 'G':
+		case '>':
+		case KEY_END:
+			for(i = res_get_nrows(res); row_exists(&p, i); i++);
+			p.top = i > body_lines(&p) ? i - body_lines(&p) : 0;
+			break;
+		case 'h':
+		case KEY_LEFT:
+			if(p.left > 0) p.left--;
+			break;
+		case 'l':
+		case KEY_RIGHT:
+			if(p.left < p.ncols - 1) p.left++;
+			break;
+		case '/':
+			if(prompt(&p)) find(&p, 1);
+			break;
+		case '?':
+			if(prompt(&p)) find(&p, -1);
+			break;
+		case 'n':
+			find(&p, 1);
+			break;
+		case 'N':
+			find(&p, -1);
+			break;
+		}
+	}
+
+	stream_puts(s, "\033[?25h\033[?1049l");
+	stream_flush(s);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+
+	// on to any further result sets
+	res_end_set(res);
+
+	free(p.widths);
+	free(p.shown);
+	free(p.search);
+}
+
+
+/*
+  Find out how big the terminal is.  Returns whether that's changed.
+*/
+static int get_size(pager *p)
+{
+	struct winsize ws;
+	int lines, columns;
+
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) || !ws.ws_row || !ws.ws_col) {
+		ws.ws_row = 24;
+		ws.ws_col = 80;
+	}
+
+	lines = ws.ws_row;
+	columns = ws.ws_col;
+	if(lines == p->lines && columns == p->columns) return 0;
+
+	p->lines = lines;
+	p->columns = columns;
+	return 1;
+}
+
+/*
+  The number of rows on a screen: the rest is the headings, with a
+  rule above and below, and the status line.
+*/
+static int body_lines(pager *p)
+{
+	return p->lines > 5 ? p->lines - 4 : 1;
+}
+
+/*
+  Wait for a key, decoding the escape sequences for cursor keys.
+  Returns KEY_RESIZE if the terminal changes size in the meantime.
+*/
+static int read_key(pager *p)
+{
+	struct pollfd fd;
+	unsigned char c, seq[3];
+	int n;
+
+	fd.fd = STDIN_FILENO;
+	fd.events = POLLIN;
+
+	for(;;) {
+		if((n = poll(&fd, 1, PAGER_POLL_MS)) == -1) {
+			if(errno == EINTR) continue;
+			err_system();
+		}
+		if(n) break;
+		if(get_size(p)) return KEY_RESIZE;
+	}
+
+	if(read(STDIN_FILENO, &c, 1) != 1) return 'q';
+	if(c != 27) return c;
+
+	// a lone escape or the start of a sequence
+	if(poll(&fd, 1, PAGER_ESCAPE_MS) < 1 || read(STDIN_FILENO, seq, 1) != 1)
+		return 27;
+	if((seq[0] != '[' && seq[0] != 'O') || read(STDIN_FILENO, seq + 1, 1) != 1)
+		return KEY_OTHER;
+
+	switch(seq[1]) {
+	case 'A': return KEY_UP;
+	case 'B': return KEY_DOWN;
+	case 'C': return KEY_RIGHT;
+	case 'D': return KEY_LEFT;
+	case 'H': return KEY_HOME;
+	case 'F': return KEY_END;
+	}
+
+	if(seq[1] < '0' || seq[1] > '9') return KEY_OTHER;
+	if(read(STDIN_FILENO, seq + 2, 1) != 1 || seq[2] != '~') return KEY_OTHER;
+
+	switch(seq[1]) {
+	case '1':
+	case '7': return KEY_HOME;
+	case '4':
+	case '8': return KEY_END;
+	case '5': return KEY_PGUP;
+	case '6': return KEY_PGDN;
+	}
+
+	return KEY_OTHER;
+}
+
+/*
+  How c is drawn, and how many columns it takes: as in a table, except
+  that line breaks are shown rather than taken.
+*/
+static const wchar_t *glyph(wchar_t c, wchar_t *buf, int *width)
+{
+	const wchar_t *t;
+
+	if(c == L'\n') t = L"<LF>";
+	else if(c == L'\r') t = L"<CR>";
+	else if(c > 0 && c < 32) t = cntrl[c];
+	else if(c == 127) t = cntrl[32];
+	else {
+		buf[0] = c;
+		buf[1] = 0;
+		*width = text_wcwidth(c);
+		if(*width < 0) *width = 0;
+		return buf;
+	}
+
+	*width = wcslen(t);
+	return t;
+}
+
+static int value_width(const wchar_t *v)
+{
+	wchar_t buf[2];
+	int width, w;
+
+	if(!v) return wcslen(cntrl[0]);
+
+	for(width = 0; *v; v++) {
+		glyph(*v, buf, &w);
+		width += w;
+	}
+
+	return width;
+}
+
+/*
+  Draw v in a cell width columns wide, cut short and marked if it
+  doesn't fit.
+*/
+static void put_value(stream *s, const wchar_t *v, int width)
+{
+	const wchar_t *t;
+	wchar_t buf[2];
+	int used, limit, w, cut;
+
+	if(!v) v = cntrl[0];
+
+	cut = value_width(v) > width;
+	limit = cut ? width - 1 : width;
+
+	for(used = 0; *v; v++) {
+		t = glyph(*v, buf, &w);
+		if(used + w > limit) break;
+		stream_putws(s, t);
+		used += w;
+	}
+
+	if(cut && width > 0) {
+		stream_putwc(s, L'>');
+		used++;
+	}
+
+	stream_spaces(s, width - used);
+}
+
+/*
+  Work out which columns fit on the screen from the left-most one
+  shown, the last perhaps only in part.  The last screen column is
+  left alone, so that nothing wraps.
+*/
+static void layout(pager *p)
+{
+	int i, x, room;
+
+	p->right = p->left;
+
+	for(i = p->left, x = 0; i < p->ncols; i++) {
+		// "| " before the value and " " after it
+		room = p->columns - 1 - x - 3;
+		if(room < 1) break;
+
+		p->shown[i] = p->widths[i] < room ? p->widths[i] : room;
+		x += p->shown[i] + 3;
+		p->right = i;
+	}
+}
+
+static void draw(pager *p)
+{
+	wchar_t **row;
+	int i, j, w, body;
+
+	body = body_lines(p);
+
+	// widen columns to fit what's about to be shown
+	for(i = p->top; i < p->top + body && (row = res_get_row_at(p->res, i)); i++) {
+		for(j = 0; j < p->ncols; j++) {
+			w = value_width(row[j]);
+			if(w > p->widths[j]) p->widths[j] = w;
+		}
+	}
+
+	layout(p);
+
+	stream_puts(p->s, "\033[H");
+	draw_rule(p, VPOS_TOP);
+	draw_row(p, res_get_cols(p->res), -1);
+	draw_rule(p, VPOS_MID);
+
+	for(i = p->top; i < p->top + body; i++) {
+		if((row = res_get_row_at(p->res, i))) draw_row(p, row, i);
+		else stream_puts(p->s, "\033[K\n");
+	}
+
+	draw_status(p);
+	stream_flush(p->s);
+}
+
+static void draw_rule(pager *p, vpos v)
+{
+	int i;
+
+	for(i = p->left; i <= p->right; i++) {
+		stream_puts(p->s, p->g.box[v][i > p->left ? HPOS_MID : HPOS_LEF]);
+		stream_repeat(p->s, p->g.dash, p->shown[i] + 2);
+	}
+	stream_puts(p->s, p->g.box[v][HPOS_RIG]);
+	stream_puts(p->s, "\033[K\n");
+}
+
+/*
+  Draw row number n (-1 for the headings).
+*/
+static void draw_row(pager *p, wchar_t **row, int n)
+{
+	int i, match;
+
+	for(i = p->left; i <= p->right; i++) {
+		match = n >= 0 && n == p->match_row && i == p->match_col;
+
+		stream_puts(p->s, p->g.bar);
+		stream_puts(p->s, match ? " \033[7m" : " ");
+		put_value(p->s, row[i], p->shown[i]);
+		stream_puts(p->s, match ? "\033[m " : " ");
+	}
+	stream_puts(p->s, p->g.bar);
+	stream_puts(p->s, "\033[K\n");
+}
+
+static void draw_status(pager *p)
+{
+	char buf[256];
+	mbstate_t ps;
+	int more, last, n;
+	size_t l, len;
+
+	n = res_get_nrows(p->res);
+	more = row_exists(p, n);
+
+	if(p->message) {
+		snprintf(buf, sizeof(buf), "%s", p->message);
+	} else {
+		last = p->top + body_lines(p);
+		if(last > n) last = n;
+
+		snprintf(buf, sizeof(buf),
+			 _("rows %d-%d of %d%s, columns %d-%d of %d (q quits, / searches)"),
+			 n ? p->top + 1 : 0, last, n, more ? "+" : "",
+			 p->left + 1, p->right + 1, p->ncols);
+	}
+
+	// no further than the screen goes, and not part way through a character
+	memset(&ps, 0, sizeof(ps));
+	for(len = 0; buf[len]; len += l) {
+		l = mbrlen(buf + len, strlen(buf + len), &ps);
+		if(l == (size_t) -1 || l == (size_t) -2) break;
+		if(len + l > (size_t) p->columns - 1) break;
+	}
+
+	stream_puts(p->s, "\033[7m");
+	stream_write(p->s, buf, len);
+	stream_puts(p->s, "\033[m\033[K");
+}
+
+/*
+  Whether there's a row i, fetching as far as it if need be.
+*/
+static int row_exists(pager *p, int i)
+{
+	return res_get_row_at(p->res, i) != 0;
+}
+
+/*
+  Move down (or, if n is negative, up) n rows, but not so far down that
+  the screen would have rows to spare.
+*/
+static void scroll(pager *p, int n)
+{
+	if(n < 0) {
+		p->top += n;
+		if(p->top < 0) p->top = 0;
+		return;
+	}
+
+	while(n-- && row_exists(p, p->top + body_lines(p))) p->top++;
+}
+
+/*
+  Read something to search for on the status line.  An empty one means
+  the last search again.  Returns 0 if the search was abandoned.
+*/
+static int prompt(pager *p)
+{
+	char buf[PAGER_SEARCH_MAX];
+	mbstate_t ps;
+	size_t n, i, l, last;
+	int c;
+
+	n = 0;
+	stream_puts(p->s, "\033[?25h");
+
+	for(;;) {
+		stream_printf(p->s, "\033[%d;1H/", p->lines);
+		stream_write(p->s, buf, n);
+		stream_puts(p->s, "\033[K");
+		stream_flush(p->s);
+
+		c = read_key(p);
+
+		if(c == '\n' || c == '\r') break;
+
+		if(c == 27 || c == 7) {
+			stream_puts(p->s, "\033[?25l");
+			return 0;
+		}
+
+		if(c == 127 || c == 8) {
+			// back to the start of the last character
+			memset(&ps, 0, sizeof(ps));
+			for(i = 0, last = 0; i < n; i += l) {
+				last = i;
+				l = mbrlen(buf + i, n - i, &ps);
+				if(l == (size_t) -1 || l == (size_t) -2 || !l) {
+					memset(&ps, 0, sizeof(ps));
+					l = 1;
+				}
+			}
+			n = last;
+		} else if(c >= 32 && c < 256 && n < sizeof(buf) - 1) {
+			buf[n++] = c;
+		}
+	}
+
+	stream_puts(p->s, "\033[?25l");
+
+	if(n) {
+		free(p->search);
+		if(!(p->search = malloc(n + 1))) err_system();
+		memcpy(p->search, buf, n);
+		p->search[n] = 0;
+		p->match_row = -1;
+	}
+
+	if(!p->search) p->message = _("No previous search");
+	return p->search != 0;
+}
+
+/*
+  Look for the search text in the values of the rows after (or, if
+  step is -1, before) the last match if it's on the screen, or else
+  from the top of the screen.  Brings the match into view.
+*/
+static void find(pager *p, int step)
+{
+	const char *v;
+	int i, j, body;
+
+	if(!p->search) {
+		p->message = _("No previous search");
+		return;
+	}
+
+	body = body_lines(p);
+
+	if(p->match_row >= p->top && p->match_row < p->top + body) i = p->match_row + step;
+	else i = step > 0 ? p->top : p->top - 1;
+
+	for(; i >= 0 && row_exists(p, i); i += step) {
+		for(j = 0; j < p->ncols; j++) {
+			if((v = res_get_mb_value(p->res, j)) && strstr(v, p->search)) {
+				p->match_row = i;
+				p->match_col = j;
+
+				if(i < p->top || i >= p->top + body) p->top = i;
+				if(j < p->left || j > p->right) p->left = j;
+				return;
+			}
+		}
+	}
+
+	p->message = _("Pattern not found");
+}
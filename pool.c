@@ -0,0 +1,224 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  A pool of threads working through a ring of blocks, for compress.c
+  and format.c.  The blocks themselves belong to the caller; the pool
+  only knows them by number.  The calling thread fills a block and
+  submits it, a worker processes it, and the calling thread writes it
+  out.  Each slot in the ring is reused in turn, so waiting for a slot
+  to come free is also what keeps the output in order.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "pool.h"
+
+#define POOL_MAX_THREADS 64
+
+
+typedef enum {
+	BLOCK_FREE,
+	BLOCK_QUEUED,
+	BLOCK_RUNNING,
+	BLOCK_DONE
+} block_state;
+
+struct block_pool {
+	pool_fn work;
+	pool_fn write;
+	void *arg;
+	int nthreads;
+	pthread_t threads[POOL_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t queued;  // workers wait on this
+	pthread_cond_t done;    // and the writer on this
+	int quit;
+	block_state *states;
+	int nblocks;
+	int current;  // the block being filled
+};
+
+
+static void write_out(block_pool *, int);
+static void *worker(void *);
+
+
+/*
+  How many threads to use: the value of the environment variable var,
+  or the number of processors.
+*/
+int pool_threads(const char *var)
+{
+	char *s;
+	long n;
+
+	s = getenv(var);
+	n = s ? atoi(s) : sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(n < 1) n = 1;
+	if(n > POOL_MAX_THREADS) n = POOL_MAX_THREADS;
+
+	return n;
+}
+
+/*
+  Start nthreads workers on a ring of nblocks blocks, the first of
+  which is the one to fill.
+*/
+block_pool *pool_create(int nthreads, int nblocks, pool_fn work, pool_fn write,
+			void *arg)
+{
+	block_pool *p;
+	int i;
+
+	if(!(p = calloc(1, sizeof(block_pool)))) err_system();
+
+	p->work = work;
+	p->write = write;
+	p->arg = arg;
+	p->nthreads = nthreads < POOL_MAX_THREADS ? nthreads : POOL_MAX_THREADS;
+	p->nblocks = nblocks;
+
+	if(!(p->states = calloc(nblocks, sizeof(block_state)))) err_system();
+
+	if((errno = pthread_mutex_init(&p->lock, 0))) err_system();
+	if((errno = pthread_cond_init(&p->queued, 0))) err_system();
+	if((errno = pthread_cond_init(&p->done, 0))) err_system();
+
+	for(i = 0; i < p->nthreads; i++)
+		if((errno = pthread_create(&p->threads[i], 0, worker, p))) err_system();
+
+	return p;
+}
+
+/*
+  Queue the current block and move on to the next, writing it out
+  first if it's still in use.  Returns the number of the block to fill
+  now.
+*/
+int pool_submit(block_pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->states[p->current] = BLOCK_QUEUED;
+	pthread_cond_signal(&p->queued);
+	pthread_mutex_unlock(&p->lock);
+
+	p->current = (p->current + 1) % p->nblocks;
+	write_out(p, p->current);
+
+	return p->current;
+}
+
+/*
+  Write out every block that's been submitted, stop the workers and
+  free the pool.  The current block is left alone, so submit it first
+  if it has anything in it.
+*/
+void pool_finish(block_pool *p)
+{
+	int i;
+
+	// pool_submit() has written out everything older than the blocks still in flight
+	for(i = 0; i < p->nblocks; i++) {
+		p->current = (p->current + 1) % p->nblocks;
+		write_out(p, p->current);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->queued);
+	pthread_mutex_unlock(&p->lock);
+
+	for(i = 0; i < p->nthreads; i++) pthread_join(p->threads[i], 0);
+
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->queued);
+	pthread_cond_destroy(&p->done);
+
+	free(p->states);
+	free(p);
+}
+
+
+/*
+  Wait for block i to be processed, if it's been queued, and write it
+  out.
+*/
+static void write_out(block_pool *p, int i)
+{
+	pthread_mutex_lock(&p->lock);
+	if(p->states[i] == BLOCK_FREE) {
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+	while(p->states[i] != BLOCK_DONE) pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	p->write(p->arg, i);
+
+	pthread_mutex_lock(&p->lock);
+	p->states[i] = BLOCK_FREE;
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void *worker(void *arg)
+{
+	block_pool *p;
+	int i, b;
+
+	p = arg;
+
+	pthread_mutex_lock(&p->lock);
+
+	for(;;) {
+		b = -1;
+		for(i = 0; i < p->nblocks; i++) {
+			if(p->states[i] == BLOCK_QUEUED) {
+				b = i;
+				break;
+			}
+		}
+
+		if(b == -1) {
+			if(p->quit) break;
+			pthread_cond_wait(&p->queued, &p->lock);
+			continue;
+		}
+
+		p->states[b] = BLOCK_RUNNING;
+		pthread_mutex_unlock(&p->lock);
+
+		p->work(p->arg, b);
+
+		pthread_mutex_lock(&p->lock);
+		p->states[b] = BLOCK_DONE;
+		pthread_cond_broadcast(&p->done);
+	}
+
+	pthread_mutex_unlock(&p->lock);
+
+	return 0;
+}
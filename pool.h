@@ -0,0 +1,34 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POOL_H
+#define POOL_H
+
+/*
+  Called with the pool's arg and the number of a block: in a worker to
+  process it, or on the calling thread to write it out.
+*/
+typedef void (*pool_fn)(void *arg, int block);
+
+int pool_threads(const char *);
+block_pool *pool_create(int, int, pool_fn, pool_fn, void *);
+int pool_submit(block_pool *);
+void pool_finish(block_pool *);
+
+#endif
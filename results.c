@@ -20,29 +20,79 @@
   This whole implementation is horribly inefficient.
   But that's fixable.  At least it has some semblance of structure now.
   Premature optimisation etc etc.
+
+  Rows and values live in a per-set arena (see arena.c), so freeing a
+  set doesn't have to walk its rows.  Rows are kept in fixed-size
+  blocks with an index of blocks, so appending a row and seeking to
+  row n are both constant time.
+
+  With DBSH_RESULT_LAYOUT=columnar, sets are stored column by column
+  instead: each column is one contiguous character buffer plus an
+  array of per-row offsets into it and a validity (non-NULL) bitmap.
+  Rows are then addressed by index rather than through row structs.
+
+  Values are kept as the multibyte strings the driver returned.  Wide
+  versions are only made when res_get_value() or res_get_row() asks
+  for them, into a per-column buffer that's reused from row to row, so
+  byte-oriented output can use res_get_mb_value() and skip conversion
+  altogether.
+
+  Results can also be filled lazily from a source (see res_set_source):
+  the last set then grows as the output asks for rows, and streaming
+  output can drop rows it has finished with using res_discard_rows(),
+  after which the set holds only the rows from its base onwards.
 */
 
 
+#include <sys/resource.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
+#include "arena.h"
 #include "err.h"
+#include "mem.h"
 #include "results.h"
+#include "spill.h"
+#include "text.h"
+
+#define SPILL_NULL ((size_t) -1)
+#define ROWS_PER_BLOCK 512
 
 
 typedef struct warn warn;
 typedef struct set set;
 typedef struct row row;
+typedef struct column column;
+typedef struct widened widened;
 
 struct results {
+	const res_source *source;
+	void *source_arg;
+	int source_done;
 	set *sets;
+	set *slast;
 	set *scursor;
-	row *rcursor;
+	int rindex;
 	warn *warnings;
+	warn *wlast;
 	warn *wcursor;
-	struct timeval time_taken;
+	wchar_t **rowbuf;
+	char **mbrowbuf;
+	unsigned int rowbuf_len;
+	widened *wide;
+	unsigned int wide_len;
+	unsigned int generation;
+	char *mbbuf;
+	size_t mbbuf_cap;
+	size_t bytes;
+	struct timespec start_time;
+	struct timespec time_taken;
+	struct timespec phase_start[RES_NPHASES];
+	unsigned int running;
+	struct rusage start_usage;
+	res_timing timing;
 };
 
 struct warn {
@@ -53,19 +103,64 @@ struct warn {
 struct set {
 	unsigned int ncols;
 	unsigned int nrows;
+	unsigned int base;
+	size_t bytes;
+	size_t fixed_bytes;
+	size_t spill_threshold;
+	spill *spill;
+	int spill_full;
+	arena *arena;
+	column *columns;
+	unsigned int rows_cap;
 	wchar_t **cols;
-	row *rows;
+	res_type *types;
+	row **blocks;
+	unsigned int blocks_cap;
 	set *next;
 };
 
+/*
+  Rows are either held in memory (data points to ncols strings) or,
+  once the set has spilled, in the spill file (data is null and
+  spilled is the offset of an array of ncols string offsets).
+*/
 struct row {
-	wchar_t **data;
-	row *next;
+	char **data;
+	size_t spilled;
+};
+
+struct column {
+	char *chars;
+	size_t len;
+	size_t cap;
+	size_t *offsets;
+	unsigned char *validity;
+};
+
+/*
+  The wide version of a value, valid while src and generation match
+  (values are only ever moved or replaced by writes, which bump the
+  generation).
+*/
+struct widened {
+	const char *src;
+	unsigned int generation;
+	wchar_t *buf;
+	size_t cap;
 };
 
 
-static wchar_t *strdup2wcs(const char *);
-static wchar_t *wstrdup(const wchar_t *);
+static void timespec_now(struct timespec *);
+static void timespec_sub(struct timespec *, const struct timespec *,
+			 const struct timespec *);
+static void timeval_sub(struct timeval *, const struct timeval *,
+			const struct timeval *);
+
+static wchar_t *strdup2wcs(const char *, size_t *);
+static char *arena_strdup(arena *, const char *, size_t *);
+static wchar_t *widen(results *, unsigned int, const char *);
+static const char *narrow(results *, const wchar_t *);
+static void account(results *, set *, ssize_t);
 
 static void warn_free(warn *);
 
@@ -73,67 +168,164 @@ static set *set_alloc();
 static void set_free(set *);
 static set *current_set(results *);
 
-static row *row_alloc();
-static void row_free(row *, unsigned int);
+static row *row_append(set *);
+static void row_init(row *, arena *, unsigned int);
+static int spilled_row_init(row *, spill *, unsigned int);
 static row *current_row(results *);
+static int spill_value(spill *, row *, unsigned int, const char *);
+static void unspill_row(results *, set *, row *);
+static char *spilled_value(spill *, row *, unsigned int);
+static char *raw_value(results *, unsigned int);
+
+static void columns_alloc(results *, set *);
+static void columns_new_row(results *, set *);
+static void column_set_value(results *, set *, unsigned int,
+			     const char *, size_t);
+static char *column_value(set *, unsigned int, int);
+static void columns_free(set *);
+static int current_index(results *);
+static int fetch_more(results *);
+static void fetch_all(results *);
+static unsigned int pause_phases(results *);
+static void resume_phases(results *, unsigned int);
+static void close_source(results *);
+static void row_scratch(results *, unsigned int);
 
 
 results *res_alloc()
 {
 	results *res;
 
-	if(!(res = malloc(sizeof(results)))) err_system();
+	if(!(res = calloc(1, sizeof(results)))) err_system();
 
 	res->sets = set_alloc();
+	res->slast = res->sets;
 	res->scursor = res->sets;
-	res->rcursor = 0;
+	res->rindex = -1;
 	res->warnings = 0;
+	res->wlast = 0;
 	res->wcursor = 0;
-	res->time_taken.tv_sec = 0;
-	res->time_taken.tv_usec = 0;
+	account(res, 0, sizeof(results) + sizeof(set));
 
 	return res;
 }
 
 void res_free(results *r)
 {
+	unsigned int i;
+
+	if(r->source) close_source(r);
+
+	mem_sub(MEM_RESULTS, r->bytes);
 	if(r->warnings) warn_free(r->warnings);
 	if(r->sets) set_free(r->sets);
+	if(r->rowbuf) free(r->rowbuf);
+	if(r->mbrowbuf) free(r->mbrowbuf);
+	for(i = 0; i < r->wide_len; i++) free(r->wide[i].buf);
+	if(r->wide) free(r->wide);
+	if(r->mbbuf) free(r->mbbuf);
 	free(r);
 }
 
 void res_start_timer(results *r)
 {
-	gettimeofday(&r->time_taken, 0);
+	timespec_now(&r->start_time);
+	getrusage(RUSAGE_SELF, &r->start_usage);
 }
 
+/*
+  Time spent laying out and printing rows (for results fetched as
+  they're output) isn't part of the time the query took.
+*/
 void res_stop_timer(results *r)
 {
-	struct timeval end_time;
+	struct timespec end_time, t;
+	res_phase p;
 
-	gettimeofday(&end_time, 0);
+	timespec_now(&end_time);
+	timespec_sub(&r->time_taken, &end_time, &r->start_time);
 
-	r->time_taken.tv_sec  = end_time.tv_sec  - r->time_taken.tv_sec;
-	r->time_taken.tv_usec = end_time.tv_usec - r->time_taken.tv_usec;
+	for(p = RES_PHASE_LAYOUT; p <= RES_PHASE_OUTPUT; p++) {
+		timespec_sub(&t, &r->time_taken, &r->timing.phases[p]);
+		r->time_taken = t;
+	}
 }
 
 struct timeval res_time_taken(results *r)
 {
-	return r->time_taken;
+	struct timeval tv;
+
+	tv.tv_sec  = r->time_taken.tv_sec;
+	tv.tv_usec = r->time_taken.tv_nsec / 1000;
+
+	return tv;
+}
+
+/*
+  Phase timers accumulate, so a phase can be started and stopped many
+  times (e.g. once per row).  Stopping a phase that isn't running is a
+  no-op, which is what makes RES_PHASE_FIRST_ROW record only the first
+  row.
+*/
+void res_phase_start(results *r, res_phase p)
+{
+	timespec_now(&r->phase_start[p]);
+	r->running |= 1 << p;
+}
+
+void res_phase_stop(results *r, res_phase p)
+{
+	struct timespec now, d, *t;
+
+	if(!(r->running & (1 << p))) return;
+
+	timespec_now(&now);
+	timespec_sub(&d, &now, &r->phase_start[p]);
+
+	t = &r->timing.phases[p];
+	t->tv_sec  += d.tv_sec;
+	t->tv_nsec += d.tv_nsec;
+	if(t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+
+	r->running &= ~(1 << p);
+}
+
+void res_sample_usage(results *r)
+{
+	struct rusage now;
+
+	if(!r->start_time.tv_sec && !r->start_time.tv_nsec) return;
+
+	getrusage(RUSAGE_SELF, &now);
+	timeval_sub(&r->timing.utime, &now.ru_utime, &r->start_usage.ru_utime);
+	timeval_sub(&r->timing.stime, &now.ru_stime, &r->start_usage.ru_stime);
+	r->timing.maxrss = now.ru_maxrss - r->start_usage.ru_maxrss;
+}
+
+const res_timing *res_get_timing(results *r)
+{
+	return &r->timing;
 }
 
 void res_add_warning(results *r, const char *text)
 
 {
-	warn **wp;
+	warn *w;
+	size_t bytes;
 
-	for(wp = &r->warnings; *wp; wp = &(*wp)->next);
+	if(!(w = malloc(sizeof(warn)))) err_system();
+	w->text = strdup2wcs(text, &bytes);
+	w->next = 0;
+	account(r, 0, sizeof(warn) + bytes);
 
-	if(!(*wp = malloc(sizeof(warn)))) err_system();
-	(*wp)->text = strdup2wcs(text);
-	(*wp)->next = 0;
+	if(r->wlast) r->wlast->next = w;
+	else r->warnings = w;
+	r->wlast = w;
 
-	if(!r->wcursor) r->wcursor = *wp;
+	if(!r->wcursor) r->wcursor = w;
 }
 
 wchar_t *res_next_warning(results *r)
@@ -148,44 +340,142 @@ wchar_t *res_next_warning(results *r)
 
 void res_add_set(results *r)
 {
-	set **sp;
+	set *s;
 
-	for(sp = &r->sets; *sp; sp = &(*sp)->next);
-	*sp = set_alloc();
-	r->scursor = *sp;
+	s = set_alloc();
+	r->slast->next = s;
+	r->slast = s;
+	r->scursor = s;
+	r->rindex = -1;
+	account(r, s, sizeof(set));
 }
 
 void res_first_set(results *r)
 {
 	r->scursor = r->sets;
-	r->rcursor = 0;
+	r->rindex = -1;
 }
 
 int res_next_set(results *r)
 {
+	unsigned int paused;
+	int more;
+
+	if(r->source && r->scursor == r->slast) {
+		// skip whatever of this set the output didn't want
+		while(fetch_more(r)) {
+			if(r->slast->nrows - r->slast->base >= ROWS_PER_BLOCK)
+				res_discard_rows(r);
+		}
+
+		paused = pause_phases(r);
+		more = r->source->next_set(r, r->source_arg);
+		resume_phases(r, paused);
+
+		if(more) {
+			r->source_done = 0;
+			return 1;
+		}
+
+		close_source(r);
+		return 0;
+	}
+
 	if(r->scursor) r->scursor = r->scursor->next;
-	r->rcursor = 0;
+	r->rindex = -1;
 	return r->scursor ? 1 : 0;
 }
 
+/*
+  Have the last set filled on demand: whenever output wants a row
+  beyond those fetched so far, fetch_row is called to add one with
+  res_new_row() and res_set_value() (returning 0 when there are no
+  more).  res_next_set() calls next_set to start the next set with
+  res_add_set(), dropping any rows of the current one that weren't
+  fetched, and close is called once that returns 0 or the results are
+  freed.
+*/
+void res_set_source(results *r, const res_source *source, void *arg)
+{
+	r->source = source;
+	r->source_arg = arg;
+	r->source_done = 0;
+}
+
+/*
+  Drop the rows of the current set fetched so far, once the current
+  row is the last of them (otherwise there are rows still to visit, so
+  this does nothing).  They still count towards res_get_nrows(), but
+  can no longer be visited.
+*/
+void res_discard_rows(results *r)
+{
+	set *s;
+	unsigned int i;
+
+	s = current_set(r);
+	if(r->rindex < 0 || r->rindex != (int) s->nrows - 1) return;
+
+	if(s->columns) {
+		for(i = 0; i < s->ncols; i++) {
+			free(s->columns[i].chars);
+			free(s->columns[i].offsets);
+			free(s->columns[i].validity);
+		}
+		memset(s->columns, 0, s->ncols * sizeof(column));
+		s->rows_cap = 0;
+	} else {
+		arena_reset(s->arena);
+		if(s->spill) spill_reset(s->spill);
+	}
+
+	account(r, s, -(ssize_t) (s->bytes - s->fixed_bytes));
+
+	s->base = s->nrows;
+	r->rindex = -1;
+	r->generation++;
+}
+
+/*
+  Stop fetching the current set: rows of it the source hasn't produced
+  yet are dropped rather than fetched, and res_next_set() goes straight
+  on to the next set.
+*/
+void res_end_set(results *r)
+{
+	if(r->source && r->scursor == r->slast) r->source_done = 1;
+}
+
 void res_set_ncols(results *r, unsigned int ncols)
 {
 	set *s;
+	const char *layout;
+	unsigned int i;
 
 	s = current_set(r);
 	if(s->nrows) err_fatal("res_set_ncols: meta set");
+	account(r, s, (ssize_t) (ncols - s->ncols) * (sizeof(wchar_t *) + sizeof(res_type)));
 	s->ncols = ncols;
+	s->spill_threshold = mem_spill_threshold();
 	if(!(s->cols = realloc(s->cols, ncols * sizeof(wchar_t *)))) err_system();
+	if(!(s->types = realloc(s->types, ncols * sizeof(res_type)))) err_system();
+	for(i = 0; i < ncols; i++) s->types[i] = RES_TYPE_TEXT;
+
+	layout = getenv("DBSH_RESULT_LAYOUT");
+	if(ncols && !s->columns && layout && !strcmp(layout, "columnar"))
+		columns_alloc(r, s);
 }
 
 void res_set_col(results *r, unsigned int i, const char *text)
 {
 	set *s;
+	size_t bytes;
 
 	s = current_set(r);
 	if(i >= s->ncols) err_fatal("res_set_col: %u, '%s' (%u columns)",
 				    i, text, s->ncols);
-	s->cols[i] = strdup2wcs(text);
+	s->cols[i] = strdup2wcs(text, &bytes);
+	account(r, s, bytes);
 }
 
 void res_set_cols(results *r, unsigned int ncols, ...)
@@ -217,6 +507,26 @@ wchar_t *res_get_col(results *r, unsigned int i)
 	return s->cols[i];
 }
 
+void res_set_col_type(results *r, unsigned int i, res_type type)
+{
+	set *s;
+
+	s = current_set(r);
+	if(i >= s->ncols) err_fatal("res_set_col_type: %u (%u columns)",
+				    i, s->ncols);
+	s->types[i] = type;
+}
+
+res_type res_get_col_type(results *r, unsigned int i)
+{
+	set *s;
+
+	s = current_set(r);
+	if(i >= s->ncols) err_fatal("res_get_col_type: %u (%u columns)",
+				    i, s->ncols);
+	return s->types[i];
+}
+
 wchar_t **res_get_cols(results *r)
 {
 	set *s;
@@ -237,42 +547,74 @@ void res_set_nrows(results *r, int nrows)
 void res_new_row(results *res)
 {
 	set *s;
-	row **rp;
+	row *r;
 
 	s = current_set(res);
-	for(rp = &s->rows; *rp; rp = &(*rp)->next);
-	*rp = row_alloc(s->ncols);
+	res->generation++;
+
+	if(s->nrows == s->base) s->fixed_bytes = s->bytes;
+
+	if(s->columns) {
+		columns_new_row(res, s);
+		res->rindex = s->nrows++;
+		return;
+	}
+
+	if(!s->spill && !s->spill_full && s->spill_threshold &&
+	   s->bytes > s->spill_threshold && !(s->spill = spill_create()))
+		s->spill_full = 1;
+
+	r = row_append(s);
 
-	res->rcursor = *rp;
-	s->nrows++;
+	if(!s->spill || s->spill_full || !spilled_row_init(r, s->spill, s->ncols)) {
+		if(s->spill) s->spill_full = 1;
+		row_init(r, s->arena, s->ncols);
+		account(res, s, s->ncols * sizeof(char *));
+	}
+
+	res->rindex = s->nrows++;
 }
 
 void res_set_value(results *res, unsigned int i, const char *value)
 {
 	set *s;
 	row *r;
+	size_t bytes;
 
 	s = current_set(res);
 	if(i >= s->ncols) err_fatal("res_set_value: %u, '%s' (%u columns)",
 				    i, value, s->ncols);
 
+	res->generation++;
+
+	if(s->columns) {
+		column_set_value(res, s, i, value, strlen(value) + 1);
+		return;
+	}
+
 	r = current_row(res);
-	if(r->data[i]) free(r->data[i]);
-	r->data[i] = strdup2wcs(value);
+	if(!r->data) {
+		if(spill_value(s->spill, r, i, value)) return;
+
+		// the file is full, so this row goes back into memory
+		s->spill_full = 1;
+		unspill_row(res, s, r);
+	}
+
+	// any previous value stays in the arena until the set is freed
+	r->data[i] = arena_strdup(s->arena, value, &bytes);
+	account(res, s, bytes);
 }
 
 void res_set_value_w(results *res, unsigned int i, const wchar_t *value)
 {
 	set *s;
-	row *r;
 
 	s = current_set(res);
 	if(i >= s->ncols) err_fatal("res_set_value_w: %u, '%ls' (%u columns)",
 				    i, value, s->ncols);
 
-	r = current_row(res);
-	if(r->data[i]) free(r->data[i]);
-	r->data[i] = wstrdup(value);
+	res_set_value(res, i, narrow(res, value));
 }
 
 void res_add_row(results *res, ...)
@@ -300,38 +642,197 @@ int res_get_nrows(results *res)
 int res_next_row(results *res)
 {
 	set *s;
+	int i;
 
-	if(res->rcursor) {
-		res->rcursor = res->rcursor->next;
-	} else {
-		s = current_set(res);
-		res->rcursor = s->rows;
+	s = current_set(res);
+
+	// meta sets (see res_set_nrows) have a count but no rows; data
+	// sets wrap round to the first row again after the last
+	if(!s->ncols) {
+		res->rindex = -1;
+		return 0;
 	}
 
-	return res->rcursor ? 1 : 0;
+	i = res->rindex < 0 ? (int) s->base : res->rindex + 1;
+
+	if(i < (int) s->nrows || fetch_more(res)) res->rindex = i;
+	else res->rindex = -1;
+
+	return res->rindex >= 0;
 }
 
 int res_more_rows(results *res)
 {
-	row *r;
+	int i, more;
 
-	r = current_row(res);
-	return r->next ? 1 : 0;
+	i = current_index(res);
+	if(i + 1 < res_get_nrows(res)) return 1;
+
+	more = fetch_more(res);
+	res->rindex = i;
+	return more;
+}
+
+/*
+  Make row i the current row (so res_get_value() and res_next_row()
+  carry on from there) and return it as res_get_row() would, or null
+  if there is no such row (or it has been discarded).
+*/
+wchar_t **res_get_row_at(results *res, int i)
+{
+	set *s;
+
+	s = current_set(res);
+	if(i < (int) s->base) return 0;
+
+	while(i >= (int) s->nrows) {
+		if(!fetch_more(res)) {
+			res->rindex = -1;
+			return 0;
+		}
+	}
+
+	res->rindex = i;
+	return res_get_row(res);
 }
 
 wchar_t *res_get_value(results *res, unsigned int i)
 {
-	return current_row(res)->data[i];
+	char *v;
+
+	if(!(v = raw_value(res, i))) return 0;
+	return widen(res, i, v);
 }
 
+/*
+  The returned array is a scratch copy, valid until the next call; the
+  strings it points to are as for res_get_value().
+*/
 wchar_t **res_get_row(results *res)
 {
-	return current_row(res)->data;
+	set *s;
+	unsigned int i;
+
+	s = current_set(res);
+	row_scratch(res, s->ncols);
+	for(i = 0; i < s->ncols; i++) res->rowbuf[i] = res_get_value(res, i);
+
+	return res->rowbuf;
+}
+
+/*
+  Values as the driver returned them, in the locale's multibyte
+  encoding, valid until the set is next written to.
+*/
+char *res_get_mb_value(results *res, unsigned int i)
+{
+	return raw_value(res, i);
+}
+
+/*
+  For spilled and columnar sets the returned array is a scratch copy,
+  valid until the next call.
+*/
+char **res_get_mb_row(results *res)
+{
+	set *s;
+	row *r;
+	unsigned int i;
+
+	s = current_set(res);
+
+	if(!s->columns) {
+		r = current_row(res);
+		if(r->data) return r->data;
+	}
+
+	row_scratch(res, s->ncols);
+	for(i = 0; i < s->ncols; i++) res->mbrowbuf[i] = raw_value(res, i);
+
+	return res->mbrowbuf;
+}
+
+/*
+  Whether the current row's values stay where they are, and unchanged,
+  until the rows are discarded or the results freed: true unless the
+  set is columnar (its storage grows as rows are fetched) or spilled.
+*/
+int res_row_is_stable(results *res)
+{
+	return !current_set(res)->columns && current_row(res)->data;
+}
+
+/*
+  Bulk access to one column of a columnar set: value j starts at
+  chars + offsets[j] and is null-terminated, and is NULL unless bit
+  (j % 8) of validity[j / 8] is set.  Returns 0 if the current set
+  isn't stored by column.  Any rows not yet fetched are fetched first;
+  j counts from the first row not discarded.
+*/
+int res_get_column(results *res, unsigned int i, res_column *c)
+{
+	set *s;
+
+	s = current_set(res);
+	if(!s->columns) return 0;
+	if(i >= s->ncols) err_fatal("res_get_column: %u (%u columns)",
+				    i, s->ncols);
+
+	fetch_all(res);
+
+	c->chars = s->columns[i].chars;
+	c->offsets = s->columns[i].offsets;
+	c->validity = s->columns[i].validity;
+	c->nrows = s->nrows - s->base;
+
+	return 1;
+}
+
+int res_spill_full(results *res)
+{
+	return current_set(res)->spill_full;
+}
+
+size_t res_get_bytes(results *res)
+{
+	return res->bytes;
+}
+
+size_t res_get_set_bytes(results *res)
+{
+	return current_set(res)->bytes;
 }
 
 
 
-static wchar_t *strdup2wcs(const char * s)
+static void timespec_now(struct timespec *t)
+{
+	if(clock_gettime(CLOCK_MONOTONIC, t)) err_system();
+}
+
+static void timespec_sub(struct timespec *d, const struct timespec *a,
+			 const struct timespec *b)
+{
+	d->tv_sec  = a->tv_sec  - b->tv_sec;
+	d->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if(d->tv_nsec < 0) {
+		d->tv_sec--;
+		d->tv_nsec += 1000000000;
+	}
+}
+
+static void timeval_sub(struct timeval *d, const struct timeval *a,
+			const struct timeval *b)
+{
+	d->tv_sec  = a->tv_sec  - b->tv_sec;
+	d->tv_usec = a->tv_usec - b->tv_usec;
+	if(d->tv_usec < 0) {
+		d->tv_sec--;
+		d->tv_usec += 1000000;
+	}
+}
+
+static wchar_t *strdup2wcs(const char * s, size_t *bytes)
 {
 	mbstate_t ps;
 	size_t len;
@@ -345,26 +846,96 @@ static wchar_t *strdup2wcs(const char * s)
 	if(!(wcs = calloc(len + 1, sizeof(wchar_t)))) err_system();
 	mbsrtowcs(wcs, &s, len, &ps);
 
+	*bytes = (len + 1) * sizeof(wchar_t);
+
 	return wcs;
 }
 
-static wchar_t *wstrdup(const wchar_t *s)
+static char *arena_strdup(arena *a, const char *s, size_t *bytes)
 {
-	wchar_t *d;
-	size_t l;
+	char *d;
 
-	l = (wcslen(s) + 1) * sizeof(wchar_t);
-	if(!(d = malloc(l))) err_system();
-	memcpy(d, s, l);
+	*bytes = strlen(s) + 1;
+	d = arena_alloc(a, *bytes);
+	memcpy(d, s, *bytes);
 
 	return d;
 }
 
+/*
+  Convert value v of column i to wide characters, reusing the last
+  conversion if it's still good.
+*/
+static wchar_t *widen(results *res, unsigned int i, const char *v)
+{
+	widened *w;
+
+	if(i >= res->wide_len) {
+		if(!(res->wide = realloc(res->wide, (i + 1) * sizeof(widened))))
+			err_system();
+		memset(res->wide + res->wide_len, 0,
+		       (i + 1 - res->wide_len) * sizeof(widened));
+		res->wide_len = i + 1;
+	}
+
+	w = &res->wide[i];
+	if(w->src == v && w->generation == res->generation) return w->buf;
+
+	text_widen(&w->buf, &w->cap, v);
+
+	w->src = v;
+	w->generation = res->generation;
+
+	return w->buf;
+}
+
+/*
+  Convert a wide string to multibyte in a scratch buffer, valid until
+  the next call.
+*/
+static const char *narrow(results *res, const wchar_t *wcs)
+{
+	mbstate_t ps;
+	const wchar_t *p;
+	size_t len;
+
+	memset(&ps, 0, sizeof(ps));
+
+	p = wcs;
+	len = wcsrtombs(0, &p, 0, &ps);
+	if(len == -1) err_system();
+
+	if(res->mbbuf_cap < len + 1) {
+		if(!(res->mbbuf = realloc(res->mbbuf, len + 1))) err_system();
+		res->mbbuf_cap = len + 1;
+	}
+
+	p = wcs;
+	wcsrtombs(res->mbbuf, &p, len + 1, &ps);
+
+	return res->mbbuf;
+}
+
+/*
+  Charge (or credit, if negative) bytes to a set, the results and the
+  session-wide total.
+*/
+static void account(results *r, set *s, ssize_t bytes)
+{
+	if(s) s->bytes += bytes;
+	r->bytes += bytes;
+	mem_add(MEM_RESULTS, bytes);
+}
+
 static void warn_free(warn *w)
 {
-	if(w->next) warn_free(w->next);
-	if(w->text) free(w->text);
-	free(w);
+	warn *next;
+
+	for(; w; w = next) {
+		next = w->next;
+		if(w->text) free(w->text);
+		free(w);
+	}
 }
 
 static set *set_alloc()
@@ -375,8 +946,19 @@ static set *set_alloc()
 
 	res->ncols = 0;
 	res->nrows = 0;
+	res->base = 0;
+	res->bytes = 0;
+	res->fixed_bytes = 0;
+	res->spill_threshold = 0;
+	res->spill = 0;
+	res->spill_full = 0;
+	res->arena = arena_create();
+	res->columns = 0;
+	res->rows_cap = 0;
 	res->cols = 0;
-	res->rows = 0;
+	res->types = 0;
+	res->blocks = 0;
+	res->blocks_cap = 0;
 	res->next = 0;
 
 	return res;
@@ -384,18 +966,25 @@ static set *set_alloc()
 
 static void set_free(set *r)
 {
+	set *next;
 	int i;
 
-	if(r->next) set_free(r->next);
+	for(; r; r = next) {
+		next = r->next;
 
-	if(r->cols) {
-		for(i = 0; i< r->ncols; i++) if(r->cols[i]) free(r->cols[i]);
-		free(r->cols);
-	}
+		if(r->cols) {
+			for(i = 0; i< r->ncols; i++) if(r->cols[i]) free(r->cols[i]);
+			free(r->cols);
+		}
+		free(r->types);
 
-	if(r->rows) row_free(r->rows, r->ncols);
+		arena_free(r->arena);
+		if(r->spill) spill_free(r->spill);
+		if(r->columns) columns_free(r);
+		if(r->blocks) free(r->blocks);
 
-	free(r);
+		free(r);
+	}
 }
 
 static set *current_set(results *r)
@@ -404,35 +993,290 @@ static set *current_set(results *r)
 	return r->scursor;
 }
 
-static row *row_alloc(int ncols)
+/*
+  Add a row to the set's last block, starting a new block if that's
+  full, and return it (uninitialised).
+*/
+static row *row_append(set *s)
 {
-	row *r;
+	unsigned int b, k;
 
-	if(!(r = malloc(sizeof(row))) ||
-	   !(r->data = calloc(ncols, sizeof(wchar_t *))))
-		err_system();
+	k = s->nrows - s->base;
+	b = k / ROWS_PER_BLOCK;
 
-	r->next = 0;
+	if(!(k % ROWS_PER_BLOCK)) {
+		if(b == s->blocks_cap) {
+			s->blocks_cap = s->blocks_cap ? s->blocks_cap * 2 : 16;
+			if(!(s->blocks = realloc(s->blocks, s->blocks_cap * sizeof(row *))))
+				err_system();
+		}
 
-	return r;
+		s->blocks[b] = arena_alloc(s->arena, ROWS_PER_BLOCK * sizeof(row));
+	}
+
+	return &s->blocks[b][k % ROWS_PER_BLOCK];
+}
+
+static void row_init(row *r, arena *a, unsigned int ncols)
+{
+	r->data = arena_alloc(a, ncols * sizeof(char *));
+	memset(r->data, 0, ncols * sizeof(char *));
+	r->spilled = 0;
 }
 
-static void row_free(row *r, unsigned int ncols)
+static int spilled_row_init(row *r, spill *sp, unsigned int ncols)
 {
+	size_t *offsets;
+	unsigned int i;
+
+	r->data = 0;
+	r->spilled = spill_alloc(sp, ncols * sizeof(size_t));
+	if(r->spilled == SPILL_FAILED) return 0;
+
+	offsets = spill_ptr(sp, r->spilled);
+	for(i = 0; i < ncols; i++) offsets[i] = SPILL_NULL;
+
+	return 1;
+}
+
+static row *current_row(results *res)
+{
+	set *s;
 	int i;
 
-	if(r->next) row_free(r->next, ncols);
+	s = current_set(res);
+	i = current_index(res) - s->base;
+
+	return &s->blocks[i / ROWS_PER_BLOCK][i % ROWS_PER_BLOCK];
+}
+
+static int spill_value(spill *sp, row *r, unsigned int i, const char *value)
+{
+	size_t offset;
+
+	offset = spill_append(sp, value, strlen(value) + 1);
+	if(offset == SPILL_FAILED) return 0;
+
+	((size_t *) spill_ptr(sp, r->spilled))[i] = offset;
+	return 1;
+}
+
+/*
+  Copy a spilled row's values into the arena, for when the spill file
+  has no room for the rest of them.
+*/
+static void unspill_row(results *res, set *s, row *r)
+{
+	char **data, *v;
+	unsigned int i;
+	size_t bytes;
+
+	data = arena_alloc(s->arena, s->ncols * sizeof(char *));
+	account(res, s, s->ncols * sizeof(char *));
 
-	if(r->data) {
-		for(i = 0; i < ncols; i++) if(r->data[i]) free(r->data[i]);
-		free(r->data);
+	for(i = 0; i < s->ncols; i++) {
+		if((v = spilled_value(s->spill, r, i))) {
+			data[i] = arena_strdup(s->arena, v, &bytes);
+			account(res, s, bytes);
+		} else data[i] = 0;
 	}
 
-	free(r);
+	r->data = data;
 }
 
-static row *current_row(results *res)
+static char *spilled_value(spill *sp, row *r, unsigned int i)
+{
+	size_t offset;
+
+	offset = ((size_t *) spill_ptr(sp, r->spilled))[i];
+	return offset == SPILL_NULL ? 0 : spill_ptr(sp, offset);
+}
+
+static char *raw_value(results *res, unsigned int i)
+{
+	set *s;
+	row *r;
+
+	s = current_set(res);
+	if(i >= s->ncols) err_fatal("raw_value: %u (%u columns)",
+				    i, s->ncols);
+
+	if(s->columns) return column_value(s, i, current_index(res));
+
+	r = current_row(res);
+	if(r->data) return r->data[i];
+	return spilled_value(s->spill, r, i);
+}
+
+static void columns_alloc(results *r, set *s)
+{
+	if(!(s->columns = calloc(s->ncols, sizeof(column)))) err_system();
+	account(r, s, s->ncols * sizeof(column));
+
+	// no point having a spill file as well
+	s->spill_threshold = 0;
+}
+
+static void columns_new_row(results *r, set *s)
 {
-	if(!res->rcursor) err_fatal("current_row: no current row");
-	return res->rcursor;
+	column *c;
+	unsigned int i, j, cap;
+
+	j = s->nrows - s->base;
+
+	if(j == s->rows_cap) {
+		cap = s->rows_cap ? s->rows_cap * 2 : 64;
+
+		for(i = 0; i < s->ncols; i++) {
+			c = &s->columns[i];
+			if(!(c->offsets = realloc(c->offsets, cap * sizeof(size_t))) ||
+			   !(c->validity = realloc(c->validity, (cap + 7) / 8)))
+				err_system();
+		}
+
+		account(r, s, s->ncols * ((cap - s->rows_cap) * sizeof(size_t) +
+					  (cap - s->rows_cap) / 8));
+		s->rows_cap = cap;
+	}
+
+	for(i = 0; i < s->ncols; i++) {
+		c = &s->columns[i];
+		c->offsets[j] = 0;
+		c->validity[j / 8] &= ~(1 << (j % 8));
+	}
+}
+
+/*
+  Values are always appended, so overwriting one (e.g. with its
+  translated form) leaves the old characters behind in the buffer.
+*/
+static void column_set_value(results *r, set *s, unsigned int i,
+			     const char *value, size_t len)
+{
+	column *c;
+	size_t cap;
+	int j;
+
+	j = current_index(r) - s->base;
+	c = &s->columns[i];
+
+	if(c->len + len > c->cap) {
+		cap = c->cap ? c->cap * 2 : 1024;
+		while(cap < c->len + len) cap *= 2;
+		if(!(c->chars = realloc(c->chars, cap))) err_system();
+		account(r, s, cap - c->cap);
+		c->cap = cap;
+	}
+
+	memcpy(c->chars + c->len, value, len);
+	c->offsets[j] = c->len;
+	c->validity[j / 8] |= 1 << (j % 8);
+	c->len += len;
+}
+
+static char *column_value(set *s, unsigned int i, int j)
+{
+	column *c;
+
+	j -= s->base;
+	c = &s->columns[i];
+	if(!(c->validity[j / 8] & (1 << (j % 8)))) return 0;
+	return c->chars + c->offsets[j];
+}
+
+static void columns_free(set *s)
+{
+	unsigned int i;
+
+	for(i = 0; i < s->ncols; i++) {
+		free(s->columns[i].chars);
+		free(s->columns[i].offsets);
+		free(s->columns[i].validity);
+	}
+
+	free(s->columns);
+}
+
+static int current_index(results *res)
+{
+	if(res->rindex < 0) err_fatal("current_index: no current row");
+	return res->rindex;
+}
+
+/*
+  Fetch another row into the last set from the source, if it's the
+  current set and there's anything left.  The new row becomes the
+  current one.  Layout and output time is paused meanwhile, so that it
+  only counts time actually spent on them.
+*/
+static int fetch_more(results *res)
+{
+	unsigned int paused;
+	int got;
+
+	if(!res->source || res->source_done || res->scursor != res->slast)
+		return 0;
+
+	paused = pause_phases(res);
+	got = res->source->fetch_row(res, res->source_arg);
+	resume_phases(res, paused);
+
+	if(!got) res->source_done = 1;
+	return got;
+}
+
+static void fetch_all(results *res)
+{
+	int i;
+
+	i = res->rindex;
+	while(fetch_more(res));
+	res->rindex = i;
+}
+
+static unsigned int pause_phases(results *res)
+{
+	unsigned int paused;
+
+	paused = res->running &
+		((1 << RES_PHASE_LAYOUT) | (1 << RES_PHASE_OUTPUT));
+
+	if(paused & (1 << RES_PHASE_LAYOUT))
+		res_phase_stop(res, RES_PHASE_LAYOUT);
+	if(paused & (1 << RES_PHASE_OUTPUT))
+		res_phase_stop(res, RES_PHASE_OUTPUT);
+
+	return paused;
+}
+
+static void resume_phases(results *res, unsigned int paused)
+{
+	if(paused & (1 << RES_PHASE_LAYOUT))
+		res_phase_start(res, RES_PHASE_LAYOUT);
+	if(paused & (1 << RES_PHASE_OUTPUT))
+		res_phase_start(res, RES_PHASE_OUTPUT);
+}
+
+static void close_source(results *res)
+{
+	const res_source *source;
+	unsigned int paused;
+
+	source = res->source;
+	res->source = 0;
+
+	paused = pause_phases(res);
+	source->close(res, res->source_arg);
+	res_stop_timer(res);
+	resume_phases(res, paused);
+}
+
+static void row_scratch(results *res, unsigned int ncols)
+{
+	if(res->rowbuf_len < ncols) {
+		if(!(res->rowbuf = realloc(res->rowbuf, ncols * sizeof(wchar_t *))) ||
+		   !(res->mbrowbuf = realloc(res->mbrowbuf, ncols * sizeof(char *))))
+			err_system();
+		res->rowbuf_len = ncols;
+	}
 }
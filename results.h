@@ -20,8 +20,57 @@
 #define RESULTS_H
 
 #include <sys/time.h>
+#include <time.h>
 #include <wchar.h>
 
+typedef enum {
+	RES_PHASE_PREPARE,
+	RES_PHASE_EXECUTE,
+	RES_PHASE_FIRST_ROW,
+	RES_PHASE_FETCH,
+	RES_PHASE_CONVERT,
+	RES_PHASE_LAYOUT,
+	RES_PHASE_OUTPUT,
+	RES_NPHASES
+} res_phase;
+
+/*
+  What kind of values a column holds, as far as output cares.
+*/
+typedef enum {
+	RES_TYPE_TEXT,
+	RES_TYPE_INTEGER,
+	RES_TYPE_FLOAT,
+	RES_TYPE_DECIMAL,
+	RES_TYPE_TIMESTAMP
+} res_type;
+
+#define RES_TYPE_IS_NUMBER(t) \
+	((t) == RES_TYPE_INTEGER || (t) == RES_TYPE_FLOAT || (t) == RES_TYPE_DECIMAL)
+
+typedef struct {
+	struct timespec phases[RES_NPHASES];
+	struct timeval utime;
+	struct timeval stime;
+	long maxrss;
+} res_timing;
+
+typedef struct {
+	const char *chars;
+	const size_t *offsets;
+	const unsigned char *validity;
+	unsigned int nrows;
+} res_column;
+
+typedef struct {
+	int (*fetch_row)(results *, void *);
+	int (*next_set)(results *, void *);
+	void (*close)(results *, void *);
+} res_source;
+
+#define RES_COLUMN_VALUE(c, j) \
+	(((c)->validity[(j) / 8] & (1 << ((j) % 8))) ? \
+	 (c)->chars + (c)->offsets[j] : 0)
 
 results *res_alloc();
 void res_free(results *);
@@ -29,6 +78,10 @@ void res_free(results *);
 void res_start_timer(results *);
 void res_stop_timer(results *);
 struct timeval res_time_taken(results *);
+void res_phase_start(results *, res_phase);
+void res_phase_stop(results *, res_phase);
+void res_sample_usage(results *);
+const res_timing *res_get_timing(results *);
 
 void res_add_warning(results *, const char *);
 wchar_t *res_next_warning(results *);
@@ -36,6 +89,9 @@ wchar_t *res_next_warning(results *);
 void res_add_set(results *);
 void res_first_set(results *);
 int res_next_set(results *);
+void res_set_source(results *, const res_source *, void *);
+void res_discard_rows(results *);
+void res_end_set(results *);
 
 void res_set_ncols(results *, unsigned int);
 void res_set_col(results *, unsigned int, const char *);
@@ -43,6 +99,8 @@ void res_set_cols(results *, unsigned int, ...);
 unsigned int res_get_ncols(results *);
 wchar_t *res_get_col(results *, unsigned int);
 wchar_t **res_get_cols(results *);
+void res_set_col_type(results *, unsigned int, res_type);
+res_type res_get_col_type(results *, unsigned int);
 
 void res_set_nrows(results *, int);
 void res_new_row(results *);
@@ -54,5 +112,14 @@ int res_next_row(results *);
 int res_more_rows(results *);
 wchar_t *res_get_value(results *, unsigned int);
 wchar_t **res_get_row(results *);
+wchar_t **res_get_row_at(results *, int);
+char *res_get_mb_value(results *, unsigned int);
+char **res_get_mb_row(results *);
+int res_row_is_stable(results *);
+int res_spill_full(results *);
+int res_get_column(results *, unsigned int, res_column *);
+
+size_t res_get_bytes(results *);
+size_t res_get_set_bytes(results *);
 
 #endif
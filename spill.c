@@ -0,0 +1,180 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Append-only storage in a memory-mapped temporary file, used by
+  results.c once a result set grows past DBSH_SPILL_THRESHOLD.  The
+  file lives in the rc dir (or $TMPDIR) and is unlinked as soon as it
+  is created, so nothing is left behind if we crash.
+
+  The mapping moves when the file grows, so callers hold offsets
+  rather than pointers and convert with spill_ptr() when they need
+  the data.
+
+  The file's blocks are allocated as it grows, rather than left sparse,
+  since writing to a hole in a mapping on a full filesystem raises
+  SIGBUS.  Running out of space is reported instead, by spill_alloc()
+  and spill_append() returning SPILL_FAILED, and the file is kept as
+  it was.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "mem.h"
+#include "rc.h"
+#include "spill.h"
+
+#define SPILL_INITIAL_SIZE (16 * 1024 * 1024)
+#define SPILL_ALIGN sizeof(size_t)
+
+
+struct spill {
+	int fd;
+	char *map;
+	size_t size;
+	size_t used;
+};
+
+
+/*
+  Make the file at least need bytes long.  Returns 0, leaving it as it
+  was, if there isn't room.
+*/
+static int spill_grow(spill *sp, size_t need)
+{
+	size_t size;
+	char *map;
+
+	size = sp->size ? sp->size : SPILL_INITIAL_SIZE;
+	while(size < need) size *= 2;
+
+#ifdef HAVE_POSIX_FALLOCATE
+	if(posix_fallocate(sp->fd, sp->size, size - sp->size)) return 0;
+#else
+	if(ftruncate(sp->fd, size)) return 0;
+#endif
+
+	map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0);
+	if(map == MAP_FAILED) return 0;
+
+	if(sp->map && munmap(sp->map, sp->size)) err_system();
+	sp->map = map;
+	sp->size = size;
+
+	return 1;
+}
+
+/*
+  Returns 0 if the file can't be created, or there's no room in it.
+*/
+spill *spill_create()
+{
+	spill *sp;
+	const char *dir;
+	char *path;
+	size_t len;
+
+	if(!(dir = get_rc_dir()) && !(dir = getenv("TMPDIR"))) dir = "/tmp";
+
+	len = strlen(dir) + strlen(PACKAGE) + 16;
+	if(!(path = malloc(len))) err_system();
+	snprintf(path, len, "%s/%s-spill.XXXXXX", dir, PACKAGE);
+
+	if(!(sp = calloc(1, sizeof(spill)))) err_system();
+
+	sp->fd = mkstemp(path);
+	if(sp->fd != -1) unlink(path);
+	free(path);
+
+	if(sp->fd == -1 || !spill_grow(sp, SPILL_INITIAL_SIZE)) {
+		if(sp->fd != -1) close(sp->fd);
+		free(sp);
+		return 0;
+	}
+
+	return sp;
+}
+
+void spill_free(spill *sp)
+{
+	mem_sub(MEM_SPILLED, sp->used);
+	munmap(sp->map, sp->size);
+	close(sp->fd);
+	free(sp);
+}
+
+/*
+  Forget everything stored so far, keeping the file and its mapping
+  for reuse.
+*/
+void spill_reset(spill *sp)
+{
+	mem_sub(MEM_SPILLED, sp->used);
+	sp->used = 0;
+}
+
+/*
+  Reserve len bytes (suitably aligned for size_t and wchar_t) and
+  return their offset, or SPILL_FAILED if there's no room for them.
+*/
+size_t spill_alloc(spill *sp, size_t len)
+{
+	size_t offset;
+
+	offset = sp->used;
+	len = (len + SPILL_ALIGN - 1) & ~(SPILL_ALIGN - 1);
+
+	if(offset + len > sp->size && !spill_grow(sp, offset + len))
+		return SPILL_FAILED;
+
+	sp->used += len;
+	mem_add(MEM_SPILLED, len);
+
+	return offset;
+}
+
+size_t spill_append(spill *sp, const void *data, size_t len)
+{
+	size_t offset;
+
+	offset = spill_alloc(sp, len);
+	if(offset != SPILL_FAILED) memcpy(sp->map + offset, data, len);
+
+	return offset;
+}
+
+void *spill_ptr(spill *sp, size_t offset)
+{
+	return sp->map + offset;
+}
+
+size_t spill_size(spill *sp)
+{
+	return sp->used;
+}
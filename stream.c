@@ -16,89 +16,293 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/*
+  Output goes through a large buffer owned by the stream rather than
+  a call to stdio per character.  Wide characters are encoded straight
+  into the buffer, by hand when the locale's encoding is UTF-8 and
+  with wcrtomb() otherwise.
+
+  What's waiting to go out is kept as a list of iovecs, mostly pointing
+  into the buffer, and written with writev() on the FILE's descriptor
+  when the buffer or list fills up, at the end of each line if the
+  FILE is a terminal (so interactive output appears as it's produced),
+  and by stream_flush(), stream_reset() and stream_free().
+  stream_write_ref() adds large pieces of data to the list where they
+  are rather than copying them, for bulk exports.  A stream can instead
+  hand its output to a compressor (see compress.c), or collect it in
+  memory for the caller to pick up (see format.c).
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <langinfo.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <wchar.h>
 
 #include "common.h"
+#include "compress.h"
 #include "err.h"
+#include "mem.h"
 #include "stream.h"
 
+#define STREAM_BUFFER_SIZE (64 * 1024)
+#define STREAM_IOV_MAX 256
+#define STREAM_REF_MIN 256  // shorter than this it's cheaper to copy
+
 
 struct stream {
 	FILE *f;
+	int fd;
 	mbstate_t ps;
+	char *buf;
+	size_t used;
+	struct iovec iov[STREAM_IOV_MAX];
+	int niov;
+	size_t written;
+	compressor *compressor;
+	char *mem;  // output collected, for streams without a FILE
+	size_t mem_len;
+	size_t mem_cap;
+	int utf8;
+	int line_flush;
+	int newline;
 };
 
 
+static stream *stream_alloc(FILE *);
+static void gather(stream *, size_t);
+static void collect(stream *);
+static void add_ref(stream *, const char *, size_t);
+static void write_all(stream *, struct iovec *, int);
+static void put_bytes(stream *, const char *, size_t);
+static void encode(stream *, const wchar_t *, size_t);
+static void done(stream *);
+
+
 stream *stream_create(FILE *f)
 {
 	stream *s;
 
-	if(!(s = calloc(1, sizeof(stream)))) err_system();
-	s->f = f;
+	s = stream_alloc(f);
+	s->fd = fileno(f);
+	s->line_flush = isatty(fileno(f));
+
+	return s;
+}
+
+/*
+  A stream whose output is kept in memory until stream_contents() is
+  called.  Only the owner of such a stream may use it, but different
+  ones can be written from different threads at once.
+*/
+stream *stream_create_buffer(void)
+{
+	stream *s;
+
+	s = stream_alloc(0);
+	s->fd = -1;
+
 	return s;
 }
 
+void stream_free(stream *s)
+{
+	stream_reset(s);
+	mem_sub(MEM_BUFFERS, STREAM_BUFFER_SIZE + s->mem_cap);
+	free(s->buf);
+	free(s->mem);
+	free(s);
+}
+
+void stream_flush(stream *s)
+{
+	int i;
+
+	if(s->niov && s->compressor) {
+		for(i = 0; i < s->niov; i++) {
+			compress_write(s->compressor, s->iov[i].iov_base, s->iov[i].iov_len);
+			s->written += s->iov[i].iov_len;
+		}
+	} else if(s->niov && !s->f) {
+		collect(s);
+	} else if(s->niov) {
+		// anything written to the FILE directly goes first
+		fflush(s->f);
+		write_all(s, s->iov, s->niov);
+	}
+
+	s->used = 0;
+	s->niov = 0;
+	s->newline = 0;
+}
+
+/*
+  Send the stream's output through c from now on.  The stream doesn't
+  own c: finish it after freeing the stream.
+*/
+void stream_set_compressor(stream *s, compressor *c)
+{
+	stream_flush(s);
+	s->compressor = c;
+}
+
+/*
+  The number of bytes written so far (not counting any still buffered).
+*/
+size_t stream_bytes(stream *s)
+{
+	return s->written;
+}
+
+int stream_isatty(stream *s)
+{
+	return s->line_flush;
+}
+
+/*
+  Everything written to a buffer stream since it was last emptied,
+  which it is by this.  The data stays valid until the next write.
+*/
+const char *stream_contents(stream *s, size_t *len)
+{
+	stream_flush(s);
+
+	*len = s->mem_len;
+	s->mem_len = 0;
+
+	return s->mem;
+}
+
 void stream_reset(stream *s)
 {
 	if(!mbsinit(&s->ps)) {
 		stream_putwc(s, 0);
 	}
+
+	stream_flush(s);
+	if(s->f) fflush(s->f);
 }
 
 void stream_puts(stream *s, const char *string)
 {
-	stream_reset(s);
-	fputs(string, s->f);
+	stream_write(s, string, strlen(string));
 }
 
 void stream_write(stream *s, const char *buf, size_t len)
 {
-	stream_reset(s);
-	fwrite(buf, sizeof(char), len, s->f);
+	if(!mbsinit(&s->ps)) stream_putwc(s, 0);
+	put_bytes(s, buf, len);
+	done(s);
+}
+
+/*
+  Like stream_write(), but buf may be written from where it is, so it
+  must stay unchanged until the next stream_flush().
+*/
+void stream_write_ref(stream *s, const char *buf, size_t len)
+{
+	if(len < STREAM_REF_MIN) {
+		stream_write(s, buf, len);
+		return;
+	}
+
+	if(!mbsinit(&s->ps)) stream_putwc(s, 0);
+	if(s->line_flush && memchr(buf, '\n', len)) s->newline = 1;
+	add_ref(s, buf, len);
+	done(s);
 }
 
 void stream_printf(stream *s, const char *fmt, ...)
 {
 	va_list ap;
-	int ret;
+	char *p;
+	int l;
 
-	stream_reset(s);
+	if(!mbsinit(&s->ps)) stream_putwc(s, 0);
 
 	va_start(ap, fmt);
-	ret = vfprintf(s->f, fmt, ap);
+	l = vsnprintf(s->buf + s->used, STREAM_BUFFER_SIZE - s->used, fmt, ap);
 	va_end(ap);
+
+	if(l < 0) err_system();
+
+	if(s->used + l < STREAM_BUFFER_SIZE) {
+		s->used += l;
+		if(memchr(s->buf + s->used - l, '\n', l)) s->newline = 1;
+		gather(s, s->used - l);
+	} else {
+		if(!(p = malloc(l + 1))) err_system();
+		va_start(ap, fmt);
+		vsnprintf(p, l + 1, fmt, ap);
+		va_end(ap);
+		put_bytes(s, p, l);
+		free(p);
+	}
+
+	done(s);
 }
 
 void stream_putwc(stream *s, wchar_t wc)
 {
-	char mb[MB_LEN_MAX];
-	size_t l;
+	encode(s, &wc, 1);
+	done(s);
+}
 
-	if((l = wcrtomb(mb, wc, &s->ps)) == -1) err_system();
+void stream_putws(stream *s, const wchar_t *wcs)
+{
+	encode(s, wcs, wcslen(wcs));
+	done(s);
+}
 
-	fwrite(mb, sizeof(char), l, s->f);
+/*
+  Write the first n characters of wcs.
+*/
+void stream_putwcs(stream *s, const wchar_t *wcs, size_t n)
+{
+	encode(s, wcs, n);
+	done(s);
 }
 
-void stream_putws(stream *s, const wchar_t *wcs)
+/*
+  Write the multibyte string mbs n times over, e.g. for the lines of a
+  table border.
+*/
+void stream_repeat(stream *s, const char *mbs, int n)
 {
-	mbstate_t psc;
-	size_t l;
-	char *mbs;
+	size_t l, chunk;
+	int i;
 
-	memcpy(&psc, &s->ps, sizeof(psc));
+	if(n <= 0) return;
+	if(!mbsinit(&s->ps)) stream_putwc(s, 0);
 
-	l = wcsrtombs(0, &wcs, 0, &psc);
-	if(l == -1) err_system();
+	l = strlen(mbs);
 
-	if(!(mbs = calloc(l + 1, sizeof(char)))) err_system();
-	wcsrtombs(mbs, &wcs, l, &s->ps);
+	if(l == 1) {
+		for(; n > 0; n -= chunk) {
+			if(s->used == STREAM_BUFFER_SIZE) stream_flush(s);
+			chunk = STREAM_BUFFER_SIZE - s->used;
+			if(chunk > n) chunk = n;
+			memset(s->buf + s->used, *mbs, chunk);
+			s->used += chunk;
+			gather(s, s->used - chunk);
+		}
+		if(*mbs == '\n') s->newline = 1;
+	} else {
+		for(i = 0; i < n; i++) put_bytes(s, mbs, l);
+	}
+
+	done(s);
+}
 
-	fputs(mbs, s->f);
-	free(mbs);
+void stream_spaces(stream *s, int n)
+{
+	stream_repeat(s, " ", n);
 }
 
 void stream_space(stream *s)
@@ -110,3 +314,189 @@ void stream_newline(stream *s)
 {
 	stream_putwc(s, L'\n');
 }
+
+
+static stream *stream_alloc(FILE *f)
+{
+	stream *s;
+	const char *codeset;
+
+	if(!(s = calloc(1, sizeof(stream)))) err_system();
+	s->f = f;
+
+	if(!(s->buf = malloc(STREAM_BUFFER_SIZE))) err_system();
+	mem_add(MEM_BUFFERS, STREAM_BUFFER_SIZE);
+
+	codeset = nl_langinfo(CODESET);
+	s->utf8 = codeset && (!strcmp(codeset, "UTF-8") || !strcmp(codeset, "utf8"));
+
+	return s;
+}
+
+/*
+  Add the bytes appended to the buffer since from to the list.
+*/
+static void gather(stream *s, size_t from)
+{
+	struct iovec *last;
+
+	if(from == s->used) return;
+
+	if(s->niov) {
+		last = &s->iov[s->niov - 1];
+		if((char *) last->iov_base + last->iov_len == s->buf + from) {
+			last->iov_len += s->used - from;
+			return;
+		}
+	}
+
+	s->iov[s->niov].iov_base = s->buf + from;
+	s->iov[s->niov].iov_len = s->used - from;
+
+	// always leave room for one more
+	if(++s->niov == STREAM_IOV_MAX - 1) stream_flush(s);
+}
+
+static void add_ref(stream *s, const char *data, size_t len)
+{
+	s->iov[s->niov].iov_base = (char *) data;
+	s->iov[s->niov].iov_len = len;
+
+	if(++s->niov == STREAM_IOV_MAX - 1) stream_flush(s);
+}
+
+/*
+  Copy what's waiting to go out onto the end of a buffer stream's
+  contents.
+*/
+static void collect(stream *s)
+{
+	size_t len, cap;
+	int i;
+
+	len = s->mem_len;
+	for(i = 0; i < s->niov; i++) len += s->iov[i].iov_len;
+
+	if(len > s->mem_cap) {
+		for(cap = s->mem_cap ? s->mem_cap : STREAM_BUFFER_SIZE; cap < len; cap *= 2);
+		if(!(s->mem = realloc(s->mem, cap))) err_system();
+		mem_add(MEM_BUFFERS, cap - s->mem_cap);
+		s->mem_cap = cap;
+	}
+
+	for(i = 0; i < s->niov; i++) {
+		memcpy(s->mem + s->mem_len, s->iov[i].iov_base, s->iov[i].iov_len);
+		s->mem_len += s->iov[i].iov_len;
+		s->written += s->iov[i].iov_len;
+	}
+}
+
+static void write_all(stream *s, struct iovec *iov, int n)
+{
+	ssize_t l;
+
+	while(n) {
+		if((l = writev(s->fd, iov, n)) == -1) {
+			if(errno == EINTR) continue;
+			return;  // as with stdio, write errors are dropped
+		}
+
+		s->written += l;
+
+		for(; n && l >= iov->iov_len; iov++, n--) l -= iov->iov_len;
+
+		if(l) {
+			iov->iov_base = (char *) iov->iov_base + l;
+			iov->iov_len -= l;
+		}
+	}
+}
+
+static void put_bytes(stream *s, const char *data, size_t len)
+{
+	if(s->line_flush && memchr(data, '\n', len)) s->newline = 1;
+
+	if(s->used + len > STREAM_BUFFER_SIZE) {
+		stream_flush(s);
+
+		// too big to be worth copying
+		if(len > STREAM_BUFFER_SIZE / 2) {
+			add_ref(s, data, len);
+			stream_flush(s);
+			return;
+		}
+	}
+
+	memcpy(s->buf + s->used, data, len);
+	s->used += len;
+	gather(s, s->used - len);
+}
+
+static void encode(stream *s, const wchar_t *wcs, size_t n)
+{
+	const wchar_t *end;
+	unsigned char *q, *qend;
+	wchar_t c;
+	size_t l;
+
+	end = wcs + n;
+
+	while(wcs < end) {
+		if(s->used >= STREAM_BUFFER_SIZE - MB_LEN_MAX) stream_flush(s);
+
+		q = (unsigned char *) s->buf + s->used;
+		qend = (unsigned char *) s->buf + STREAM_BUFFER_SIZE - MB_LEN_MAX;
+
+		if(!s->utf8) {
+			for(; wcs < end && q < qend; wcs++) {
+				if(*wcs == L'\n') s->newline = 1;
+				if((l = wcrtomb((char *) q, *wcs, &s->ps)) == -1) err_system();
+				q += l;
+			}
+		} else {
+			for(; wcs < end && q < qend; wcs++) {
+				c = *wcs;
+
+				if(c < 0x80) {
+					if(c == L'\n') s->newline = 1;
+					*q++ = c;
+				} else if(c < 0x800) {
+					*q++ = 0xc0 | (c >> 6);
+					*q++ = 0x80 | (c & 0x3f);
+				} else if(c < 0x10000) {
+					if(c >= 0xd800 && c < 0xe000) {
+						errno = EILSEQ;
+						err_system();
+					}
+					*q++ = 0xe0 | (c >> 12);
+					*q++ = 0x80 | ((c >> 6) & 0x3f);
+					*q++ = 0x80 | (c & 0x3f);
+				} else if(c < 0x110000) {
+					*q++ = 0xf0 | (c >> 18);
+					*q++ = 0x80 | ((c >> 12) & 0x3f);
+					*q++ = 0x80 | ((c >> 6) & 0x3f);
+					*q++ = 0x80 | (c & 0x3f);
+				} else {
+					errno = EILSEQ;
+					err_system();
+				}
+			}
+		}
+
+		l = s->used;
+		s->used = (char *) q - s->buf;
+		gather(s, l);
+	}
+}
+
+/*
+  Called at the end of each write: terminals get each line as soon as
+  it's complete.
+*/
+static void done(stream *s)
+{
+	if(s->line_flush && s->newline) {
+		stream_flush(s);
+		fflush(s->f);
+	}
+}
@@ -23,12 +23,23 @@
 #include <wchar.h>
 
 stream *stream_create(FILE *);
+stream *stream_create_buffer(void);
+void stream_free(stream *);
+void stream_flush(stream *);
 void stream_reset(stream *);
+size_t stream_bytes(stream *);
+int stream_isatty(stream *);
+const char *stream_contents(stream *, size_t *);
+void stream_set_compressor(stream *, compressor *);
 void stream_puts(stream *, const char *);
 void stream_write(stream *, const char *, size_t);
+void stream_write_ref(stream *, const char *, size_t);
 void stream_printf(stream *, const char *, ...) __attribute__ ((format(printf, 2, 3)));
 void stream_putwc(stream *, wchar_t);
 void stream_putws(stream *, const wchar_t *);
+void stream_putwcs(stream *, const wchar_t *, size_t);
+void stream_repeat(stream *, const char *, int);
+void stream_spaces(stream *, int);
 void stream_space(stream *);
 void stream_newline(stream *);
 
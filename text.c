@@ -0,0 +1,345 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Fast paths for the character-at-a-time loops in output.c.
+
+  text_ascii_run() finds how many characters at the start of a string
+  are printable ASCII (so need no translation and are one column
+  wide each).  On x86-64 it compares 8 (AVX2) or 4 (SSE2) characters
+  at a time, picking the widest the CPU supports the first time it's
+  called.  Vector loads are aligned so that they never cross into a
+  page the string doesn't reach, even though they may read past its
+  terminator (so the sanitizers are told to look away).
+
+  text_json_run() and text_markup_run() do the same for bytes that can
+  go into a JSON string or HTML/XML text as they are, 16 at a time with
+  SSE2 (which every x86-64 CPU has).
+
+  text_csv_run() finds the bytes at the start of a CSV value that can
+  be written without quoting, also 16 at a time with SSE2.
+
+  text_wcwidth() caches wcwidth() for the Basic Multilingual Plane,
+  which assumes LC_CTYPE doesn't change once output has started.
+
+  The choice of vector code and the width cache are filled in lazily,
+  so text_init_threads() must be called before any of these are used
+  from more than one thread.
+*/
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if defined(HAVE_IMMINTRIN_H) && defined(__x86_64__) && defined(__GNUC__)
+#define TEXT_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "err.h"
+#include "text.h"
+
+#define WIDTH_UNKNOWN -2
+#define BMP_SIZE 0x10000
+
+
+static size_t ascii_run_init(const wchar_t *);
+static size_t byte_run(const char *, const char *);
+static size_t csv_run(const char *, char, char);
+static size_t (*ascii_run)(const wchar_t *) = ascii_run_init;
+
+static signed char bmp_widths[BMP_SIZE];
+static int bmp_widths_ready;
+
+
+size_t text_ascii_run(const wchar_t *s)
+{
+	return ascii_run(s);
+}
+
+/*
+  The number of bytes at the start of s that need no escaping in a JSON
+  string: anything but '"', '\\' and control characters.
+*/
+size_t text_json_run(const char *s)
+{
+	return byte_run(s, "\"\\");
+}
+
+/*
+  Likewise for HTML and XML text and attribute values: anything but
+  '&', '<', '>', '"' and control characters.
+*/
+size_t text_markup_run(const char *s)
+{
+	return byte_run(s, "&<>\"");
+}
+
+/*
+  The number of bytes at the start of s that are none of sep, quote,
+  CR, LF or the terminator, so s needs quoting in CSV only if s[run]
+  isn't 0.
+*/
+size_t text_csv_run(const char *s, char sep, char quote)
+{
+	return csv_run(s, sep, quote);
+}
+
+/*
+  Convert v to wide characters in *buf, growing it (and *cap) to fit.
+  Bytes that aren't valid in the current locale come out as '?'
+  rather than being fatal, since by now we're part way through
+  printing the results.
+*/
+wchar_t *text_widen(wchar_t **buf, size_t *cap, const char *v)
+{
+	mbstate_t ps;
+	const char *p;
+	wchar_t *q;
+	size_t len, l;
+
+	// never more wide characters than bytes
+	len = strlen(v);
+	if(*cap < len + 1) {
+		if(!(*buf = realloc(*buf, (len + 1) * sizeof(wchar_t))))
+			err_system();
+		*cap = len + 1;
+	}
+
+	memset(&ps, 0, sizeof(ps));
+	p = v;
+	if(mbsrtowcs(*buf, &p, len + 1, &ps) == -1) {
+		memset(&ps, 0, sizeof(ps));
+		for(p = v, q = *buf; *p; q++) {
+			l = mbrtowc(q, p, len - (p - v), &ps);
+			if(l == -1 || l == -2) {
+				memset(&ps, 0, sizeof(ps));
+				*q = L'?';
+				l = 1;
+			}
+			p += l;
+		}
+		*q = 0;
+	}
+
+	return *buf;
+}
+
+/*
+  Fill in everything that's otherwise done on first use.
+*/
+void text_init_threads(void)
+{
+	int i;
+
+	text_ascii_run(L"");
+
+	for(i = 0; i < BMP_SIZE; i++) text_wcwidth(i);
+}
+
+int text_wcwidth(wchar_t c)
+{
+	int i;
+
+	if(c < 0 || c >= BMP_SIZE) return wcwidth(c);
+
+	if(!bmp_widths_ready) {
+		for(i = 0; i < BMP_SIZE; i++) bmp_widths[i] = WIDTH_UNKNOWN;
+		bmp_widths_ready = 1;
+	}
+
+	if(bmp_widths[c] == WIDTH_UNKNOWN) bmp_widths[c] = wcwidth(c);
+	return bmp_widths[c];
+}
+
+
+static int plain_byte(char c, const char *stop)
+{
+	return (unsigned char) c >= 0x20 && !strchr(stop, c);
+}
+
+/*
+  The number of bytes at the start of s that are neither control
+  characters nor any of the (up to 4) bytes in stop.
+*/
+#ifndef TEXT_SIMD
+
+static size_t byte_run(const char *s, const char *stop)
+{
+	const char *p;
+
+	for(p = s; plain_byte(*p, stop); p++);
+	return p - s;
+}
+
+#else
+
+__attribute__((no_sanitize_address, no_sanitize_thread))
+static size_t byte_run(const char *s, const char *stop)
+{
+	const char *p;
+	__m128i v, m, cntrl, stops[4];
+	int i, n, mask;
+
+	for(p = s; (uintptr_t) p % 16; p++)
+		if(!plain_byte(*p, stop)) return p - s;
+
+	n = strlen(stop);
+	for(i = 0; i < n; i++) stops[i] = _mm_set1_epi8(stop[i]);
+	cntrl = _mm_set1_epi8(0x1f);
+
+	for(;; p += 16) {
+		v = _mm_load_si128((const __m128i *) p);
+
+		// max(v, 0x1f) == 0x1f iff v <= 0x1f, unsigned
+		m = _mm_cmpeq_epi8(_mm_max_epu8(v, cntrl), cntrl);
+		for(i = 0; i < n; i++) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, stops[i]));
+
+		if((mask = _mm_movemask_epi8(m))) return p - s + __builtin_ctz(mask);
+	}
+}
+
+#endif
+
+static int csv_plain(char c, char sep, char quote)
+{
+	return c && c != '\n' && c != '\r' && c != sep && c != quote;
+}
+
+#ifndef TEXT_SIMD
+
+static size_t csv_run(const char *s, char sep, char quote)
+{
+	const char *p;
+
+	for(p = s; csv_plain(*p, sep, quote); p++);
+	return p - s;
+}
+
+#else
+
+__attribute__((no_sanitize_address, no_sanitize_thread))
+static size_t csv_run(const char *s, char sep, char quote)
+{
+	const char *p;
+	__m128i v, m, zero, lf, cr, sepv, quotev;
+	int mask;
+
+	for(p = s; (uintptr_t) p % 16; p++)
+		if(!csv_plain(*p, sep, quote)) return p - s;
+
+	zero = _mm_setzero_si128();
+	lf = _mm_set1_epi8('\n');
+	cr = _mm_set1_epi8('\r');
+	sepv = _mm_set1_epi8(sep);
+	quotev = _mm_set1_epi8(quote);
+
+	for(;; p += 16) {
+		v = _mm_load_si128((const __m128i *) p);
+
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+					      _mm_cmpeq_epi8(v, lf)),
+				 _mm_or_si128(_mm_cmpeq_epi8(v, cr),
+					      _mm_or_si128(_mm_cmpeq_epi8(v, sepv),
+							   _mm_cmpeq_epi8(v, quotev))));
+
+		if((mask = _mm_movemask_epi8(m))) return p - s + __builtin_ctz(mask);
+	}
+}
+
+#endif
+
+static int printable_ascii(wchar_t c)
+{
+	return c >= 0x20 && c < 0x7f;
+}
+
+static size_t ascii_run_scalar(const wchar_t *s)
+{
+	const wchar_t *p;
+
+	for(p = s; printable_ascii(*p); p++);
+	return p - s;
+}
+
+#ifdef TEXT_SIMD
+
+__attribute__((no_sanitize_address, no_sanitize_thread))
+static size_t ascii_run_sse2(const wchar_t *s)
+{
+	const wchar_t *p;
+	__m128i v, lo, hi;
+	int mask;
+
+	for(p = s; (uintptr_t) p % 16; p++)
+		if(!printable_ascii(*p)) return p - s;
+
+	lo = _mm_set1_epi32(0x1f);
+	hi = _mm_set1_epi32(0x7f);
+
+	for(;; p += 4) {
+		v = _mm_load_si128((const __m128i *) p);
+		mask = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_and_si128(_mm_cmpgt_epi32(v, lo),
+				      _mm_cmplt_epi32(v, hi))));
+		if(mask != 0xf) return p - s + __builtin_ctz(~mask);
+	}
+}
+
+__attribute__((target("avx2"), no_sanitize_address, no_sanitize_thread))
+static size_t ascii_run_avx2(const wchar_t *s)
+{
+	const wchar_t *p;
+	__m256i v, lo, hi;
+	int mask;
+
+	for(p = s; (uintptr_t) p % 32; p++)
+		if(!printable_ascii(*p)) return p - s;
+
+	lo = _mm256_set1_epi32(0x1f);
+	hi = _mm256_set1_epi32(0x7f);
+
+	for(;; p += 8) {
+		v = _mm256_load_si256((const __m256i *) p);
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_and_si256(_mm256_cmpgt_epi32(v, lo),
+					 _mm256_cmpgt_epi32(hi, v))));
+		if(mask != 0xff) return p - s + __builtin_ctz(~mask);
+	}
+}
+
+#endif
+
+static size_t ascii_run_init(const wchar_t *s)
+{
+	ascii_run = ascii_run_scalar;
+
+#ifdef TEXT_SIMD
+	if(sizeof(wchar_t) == 4) {
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) ascii_run = ascii_run_avx2;
+		else ascii_run = ascii_run_sse2;
+	}
+#endif
+
+	return ascii_run(s);
+}
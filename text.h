@@ -0,0 +1,33 @@
+/*
+    dbsh - text-based ODBC client
+    Copyright (C) 2007, 2008 Ben Spencer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <sys/types.h>
+#include <wchar.h>
+
+size_t text_ascii_run(const wchar_t *);
+size_t text_json_run(const char *);
+size_t text_markup_run(const char *);
+size_t text_csv_run(const char *, char, char);
+int text_wcwidth(wchar_t);
+wchar_t *text_widen(wchar_t **, size_t *, const char *);
+void text_init_threads(void);
+
+#endif